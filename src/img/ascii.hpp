@@ -0,0 +1,115 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "luma.hpp"
+#include "pixel.hpp"
+#include <array>
+#include <span>
+#include <string_view>
+
+namespace img::ascii
+{
+#if defined(IMG_X86)
+	namespace kernel {
+		/// 16 pixels per step, table index is computed in 16 bits lanes and looked up by pshufb
+		/// @param chars first `len` bytes are table
+		/// @return number of pixels done, rest is left for scalar loop
+		template<typename PX>
+		IMG_TARGET("ssse3") size_t map_row_ssse3(const PX* px, size_t n, char* out, __m128i chars, int len) {
+			using img::kernel::luma4;
+			constexpr size_t S = sizeof(PX);
+			// weights in memory order of pixel
+			const __m128i w = S == 3 ? img::kernel::luma_weights<2, 1, 0>() : img::kernel::luma_weights<0, 1, 2>();
+			const __m128i vlen = _mm_set1_epi16(static_cast<int16_t>(len));
+			const __m128i max = _mm_set1_epi16(255);
+			// Rgb24 loads read 4 bytes after last pixel of step
+			const size_t tail = sizeof(PX) == 3 ? 2 : 0;
+			size_t i = 0;
+			for (; i + 16 + tail <= n; i += 16) {
+				const uint8_t* p = reinterpret_cast<const uint8_t*>(px + i);
+				__m128i a = _mm_packs_epi32(luma4<S>(p, w), luma4<S>(p + 4 * S, w));
+				__m128i b = _mm_packs_epi32(luma4<S>(p + 8 * S, w), luma4<S>(p + 12 * S, w));
+				a = _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(max, a), vlen), 8);
+				b = _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(max, b), vlen), 8);
+				__m128i idx = _mm_packus_epi16(a, b);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(chars, idx));
+			}
+			return i;
+		}
+
+		/// same as map_row_ssse3 for luma plane
+		IMG_TARGET("ssse3") inline size_t map_luma_ssse3(const uint8_t* y, size_t n, char* out, __m128i chars, int len) {
+			const __m128i vlen = _mm_set1_epi16(static_cast<int16_t>(len));
+			const __m128i max = _mm_set1_epi8(-1);
+			const __m128i zero = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16) {
+				__m128i v = _mm_sub_epi8(max, _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i)));
+				__m128i a = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), vlen), 8);
+				__m128i b = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), vlen), 8);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(chars, _mm_packus_epi16(a, b)));
+			}
+			return i;
+		}
+	}
+#endif
+
+	/// map luminance of pixel to character of table, higher luminance first
+	struct CharMap {
+		/// @param table must not be empty
+		explicit CharMap(std::string_view table) {
+			const size_t len = table.size();
+			for (size_t y = 0; y < lut.size(); ++y) {
+				lut[y] = table[(255 - y) * len / 256];
+			}
+#if defined(IMG_X86)
+			if (cpu::features().ssse3 && len <= 16) {
+				char c[16]{};
+				table.copy(c, len);
+				m_chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c));
+				m_len = static_cast<int>(len);
+			}
+#endif
+		}
+
+		template<typename PX>
+		char operator()(PX c) const {
+			return lut[luma8(c)];
+		}
+
+		/// @param out must hold `px.size()` characters
+		template<typename PX>
+		void map_row(std::span<const PX> px, char* out) const {
+			size_t i = 0;
+#if defined(IMG_X86)
+			if (m_len) {
+				i = kernel::map_row_ssse3(px.data(), px.size(), out, m_chars, m_len);
+			}
+#endif
+			for (; i < px.size(); ++i) {
+				out[i] = lut[luma8(px[i])];
+			}
+		}
+
+		/// @param luma plane of luma8() values
+		/// @param out must hold `luma.size()` characters
+		void map_row(std::span<const uint8_t> luma, char* out) const {
+			size_t i = 0;
+#if defined(IMG_X86)
+			if (m_len) {
+				i = kernel::map_luma_ssse3(luma.data(), luma.size(), out, m_chars, m_len);
+			}
+#endif
+			for (; i < luma.size(); ++i) {
+				out[i] = lut[luma[i]];
+			}
+		}
+
+	private:
+		std::array<char, 256> lut;
+#if defined(IMG_X86)
+		__m128i m_chars{};
+		int m_len = 0; // table length when pshufb kernel is usable
+#endif
+	};
+}
@@ -1,21 +1,17 @@
 #pragma once
 
 #include "pixel.hpp"
+#include "bmp_convert.hpp"
 #include "bmp_error.hpp"
+#include "source.hpp"
 #include <iostream>
 #include <vector>
-#include <fstream>
+#include <span>
+#include <cstdint>
+#include <cstdlib>
 
 namespace img::bmp {
 
-	std::istream& read_rgb24(std::istream& is, Rgb24& pixel)
-	{
-		return is
-			.read(reinterpret_cast<char*>(&pixel.b), 1)
-			.read(reinterpret_cast<char*>(&pixel.g), 1)
-			.read(reinterpret_cast<char*>(&pixel.r), 1);
-	}
-
 	enum struct BitDepth :uint16_t {
 		bit1 = 1, bit4 = 4, bit8 = 8,
 		bit16 = 16, bit24 = 24, bit32 = 32
@@ -60,28 +56,94 @@ namespace img::bmp {
 		
 		std::string_view signature() const
 		{
-			return header.signature;
+			return { header.signature, 2 };
+		}
+
+		/// width and height without sign, valid only after dimensions are checked, see check_size()
+		uint32_t width() const
+		{
+			return static_cast<uint32_t>(std::abs(dib.width));
+		}
+
+		uint32_t height() const
+		{
+			return static_cast<uint32_t>(std::abs(dib.height));
+		}
+
+		/// bytes of pixels in each row without padding
+		uint64_t data_size() const
+		{
+			return (uint64_t{ static_cast<uint32_t>(dib.bitdepth) } * width() + 7) / 8;
+		}
+
+		/// bytes of each row including padding, rows are aligned to 4 bytes
+		uint64_t row_size() const
+		{
+			return (uint64_t{ static_cast<uint32_t>(dib.bitdepth) } * width() + 31) / 32 * 4;
 		}
 
 		uint32_t pad() const
 		{
-			auto d = (dib.width % 4);
-			return (d == 0) ? 0 : 4 - d;
+			return static_cast<uint32_t>(row_size() - data_size());
 		}
 
-		uint32_t pixel_size() const
+		/// negative height mean first row in file is top row
+		bool top_down() const
 		{
-			return std::abs(dib.width * dib.height);
+			return dib.height < 0;
 		}
+
+		uint64_t pixel_size() const
+		{
+			return uint64_t{ width() } * height();
+		}
+
+		bool rle() const
+		{
+			return dib.compress_method == CompressMethod::BI_RLE8 || dib.compress_method == CompressMethod::BI_RLE4;
+		}
+
 		Header header;
 		DIB dib;
+		Color_info colors;
 	};
 
+	/// @return kernel of format, nullptr for 24 bits that is used as is.
+	/// RLE rows are decoded to 8 bits palette index first
+	expand_fn select_expander(const Bmp& bmp)
+	{
+		if (bmp.rle()) {
+			return expand::indexed<8>;
+		}
+		switch (bmp.dib.bitdepth)
+		{
+		case BitDepth::bit1:
+			return expand::indexed<1>;
+		case BitDepth::bit4:
+			return expand::indexed<4>;
+		case BitDepth::bit8:
+			return expand::indexed<8>;
+		case BitDepth::bit16:
+			return expand::masked<16>;
+		case BitDepth::bit32:
+			if (bmp.colors.mask[0] == 0xFF'0000 && bmp.colors.mask[1] == 0xFF00 && bmp.colors.mask[2] == 0xFF) {
+				return expand::bgrx;
+			}
+			return expand::masked<32>;
+		default:
+			return nullptr;
+		}
+	}
+
 	
+	static_assert(sizeof(Rgb24) == 3, "Rgb24 must be same layout as BMP 24 bits pixel");
+
+	/// rows in top to bottom order, each row is taken from source in one go, mapped
+	/// file hand out rows without copy. returned row is valid until next row is read
 	template <typename PX = Rgb24, size_t PX_SIZE = 3>
 	struct BmpRowView {
 		using pixel_type = PX;
-		using row_type = std::vector<pixel_type>;
+		using row_type = std::span<const pixel_type>;
 
 		struct iterator
 		{
@@ -90,14 +152,14 @@ namespace img::bmp {
 			using value_type = row_type;
 			using difference_type = int64_t;
 			using pointer = int64_t;
-			using reference = const row_type&;
+			using reference = row_type;
 			using self_type = iterator;
 
 			iterator(pointer _ptr, view_type& _view) : ptr{ _ptr }, view{ _view } {}
 
 			self_type& operator++()
 			{
-				--ptr;
+				++ptr;
 				return *this;
 			}
 			self_type operator++(int)
@@ -108,120 +170,343 @@ namespace img::bmp {
 			}
 			bool operator==(self_type other) const { return ptr == other.ptr; }
 			bool operator!=(self_type other) const { return !(*this == other); }
-			reference operator*() const { return view[ptr]; }
+			reference operator*() const { return view.nth(ptr); }
 
 		private:
 			pointer ptr;
 			view_type& view;
 		};
 
-		BmpRowView(std::istream& _is, const Bmp& bmp) :
-			is{ _is },
+		BmpRowView(ByteSource& _src, const Bmp& bmp) :
+			src{ _src },
+			colors{ bmp.colors },
+			expand{ select_expander(bmp) },
 			offset{ bmp.header.offset },
-			w{ static_cast<uint32_t>(std::abs(bmp.dib.width)) },
-			h{ static_cast<uint32_t>(std::abs(bmp.dib.height)) },
-			row_size{ w * PX_SIZE + bmp.pad() },
-			row_buf{},
-			px_buf{}
+			w{ bmp.width() },
+			h{ bmp.height() },
+			row_size{ static_cast<uint32_t>(bmp.row_size()) },
+			data_size{ static_cast<uint32_t>(bmp.data_size()) },
+			top_down{ bmp.top_down() },
+			rle{ bmp.rle() },
+			rle4{ bmp.dib.compress_method == CompressMethod::BI_RLE4 }
 		{
-			row_buf.reserve(w);
 		}
 
-		row_type& operator[](int64_t ro)
+		/// @param ro row from top
+		row_type operator[](int64_t ro)
 		{
-			is.seekg(offset + row_size * (ro - 1), std::ios::beg);
-			row_buf.clear();
+			int64_t file_row = top_down ? ro : h - 1 - ro;
+			bytes_view data;
+			if (rle) {
+				if (index.empty()) {
+					decode_rle();
+				}
+				data = bytes_view{ index }.subspan(size_t{ w } * file_row, w);
+			}
+			else {
+				data = read_row(file_row);
+			}
 
-			for (uint32_t i = 0; i < w; ++i) {
-				read_rgb24(is, px_buf);
-				row_buf.push_back(px_buf);
+			if (!expand) {
+				return { reinterpret_cast<const pixel_type*>(data.data()), w };
 			}
+			pixels.resize(w);
+			expand(data, pixels.data(), w, colors);
+			return pixels;
+		}
 
-			return row_buf;
+		/// iterate only `rows` (from top, ascending) instead of every row, other rows are
+		/// never read. `rows` must outlive iteration
+		void sample(std::span<const uint32_t> rows) {
+			sampled = rows;
 		}
 
-		iterator begin() { return iterator{ h, *this }; }
-		iterator end() { return iterator{ 0, *this }; }
+		/// iterate rows as they are stored, from last row up for bottom up image, so pixel array is
+		/// read forward without seek. that is only way to read bottom up image from forward only source
+		/// @return true when rows are iterated from last one up
+		bool file_order() {
+			reversed = !top_down && !rle;
+			return reversed;
+		}
+
+		/// @return `i`th row of iteration
+		row_type nth(int64_t i) {
+			if (reversed) {
+				i = (sampled.empty() ? h : static_cast<int64_t>(sampled.size())) - 1 - i;
+			}
+			return (*this)[sampled.empty() ? i : sampled[i]];
+		}
+
+		iterator begin() { return iterator{ 0, *this }; }
+		iterator end() { return iterator{ sampled.empty() ? h : static_cast<int64_t>(sampled.size()), *this }; }
 
 	private:
-		std::istream& is;
-		pixel_type px_buf;
-		row_type row_buf;
+		bytes_view read_row(int64_t file_row)
+		{
+			int64_t pos = offset + row_size * file_row;
+			if (pos != next_pos && !src.seek(pos)) { // rows in file order are read without seek
+				throw std::system_error(make_error_code(BmpError::unexpected_eof));
+			}
+			bytes_view row = src.take_exact(row_size, row_buf);
+			next_pos = pos + row_size;
+			// expander reads `data_size` bytes for `w` pixels, padding may be cut at end of file
+			if (row.size() < data_size) {
+				throw std::system_error(make_error_code(BmpError::unexpected_eof));
+			}
+			return row;
+		}
+
+		/// decode whole RLE8/RLE4 image into palette indexes, rows in file order.
+		/// pixels that delta or end of line skip stay index 0
+		void decode_rle()
+		{
+			index.assign(size_t{ w } * h, 0);
+			if (!src.seek(offset)) {
+				throw std::system_error(make_error_code(BmpError::unexpected_eof));
+			}
+			bytes_view buf;
+			size_t at = 0;
+			auto next = [&]() -> uint8_t {
+				if (at == buf.size()) {
+					buf = src.take(1 << 16);
+					at = 0;
+					if (buf.empty()) {
+						throw std::system_error(make_error_code(BmpError::unexpected_eof));
+					}
+				}
+				return buf[at++];
+			};
+			uint32_t x = 0;
+			uint32_t y = 0;
+			auto put = [&](uint8_t v) {
+				if (x < w) {
+					index[size_t{ w } * y + x] = v;
+				}
+				++x;
+			};
+
+			while (y < h) {
+				const uint8_t n = next();
+				const uint8_t v = next();
+				if (n) { // run of `n` pixels, RLE4 alternates both nibbles
+					for (uint32_t i = 0; i < n; ++i) {
+						put(rle4 ? (i % 2 ? v & 0xF : v >> 4) : v);
+					}
+					continue;
+				}
+				switch (v)
+				{
+				case 0: // end of line
+					x = 0;
+					++y;
+					break;
+				case 1: // end of bitmap
+					return;
+				case 2: // delta
+					x += next();
+					y += next();
+					break;
+				default: { // `v` pixels as they are, padded to 2 bytes
+					uint8_t b = 0;
+					for (uint32_t i = 0; i < v; ++i) {
+						if (!rle4) {
+							put(next());
+						}
+						else {
+							if (i % 2 == 0) {
+								b = next();
+							}
+							put(i % 2 ? b & 0xF : b >> 4);
+						}
+					}
+					if ((rle4 ? (v + 1) / 2 : v) % 2) {
+						next();
+					}
+					break;
+				}
+				}
+			}
+		}
+
+		ByteSource& src;
+		const Color_info& colors;
+		const expand_fn expand;
 		const uint32_t offset;
 		const uint32_t w;
 		const uint32_t h;
 		const uint32_t row_size;
+		const uint32_t data_size; // row_size without padding, what row of `w` pixels take
+		const bool top_down;
+		const bool rle;
+		const bool rle4;
+		std::vector<uint8_t> row_buf; // only for row that source can't hand out in one view
+		std::vector<pixel_type> pixels; // expanded row of formats other than 24 bits
+		std::vector<uint8_t> index; // whole RLE image
+		int64_t next_pos = -1;
+		std::span<const uint32_t> sampled;
+		bool reversed = false;
 	};
 
-	std::istream& operator>>(std::istream& is, Header& head)
+	/// @return false when source is ended
+	bool read_header(ByteSource& src, Header& head)
 	{
-		return is
-			.read(head.signature, 2)
-			.read(reinterpret_cast<char*>(&head.img_size), 4)
-			.read(reinterpret_cast<char*>(&head.reserved1), 2)
-			.read(reinterpret_cast<char*>(&head.reserved1), 2)
-			.read(reinterpret_cast<char*>(&head.offset), 4);
+		return src.read(head.signature, 2) == 2
+			&& read_le(src, head.img_size)
+			&& read_le(src, head.reserved1)
+			&& read_le(src, head.reserved2)
+			&& read_le(src, head.offset);
 	}
 
-	std::istream& operator>>(std::istream& is, DIB& dib)
+	/// @return false when source is ended
+	bool read_dib(ByteSource& src, DIB& dib)
 	{
-		return is
-			.read(reinterpret_cast<char*>(&dib.size), 4)
-			.read(reinterpret_cast<char*>(&dib.width), 4)
-			.read(reinterpret_cast<char*>(&dib.height), 4)
-			.read(reinterpret_cast<char*>(&dib.colorplane_num), 2)
-			.read(reinterpret_cast<char*>(&dib.bitdepth), 2)
-			.read(reinterpret_cast<char*>(&dib.compress_method), 4)
-			.read(reinterpret_cast<char*>(&dib.raw_img_size), 4)
-			.read(reinterpret_cast<char*>(&dib.horizontal_ppm), 4)
-			.read(reinterpret_cast<char*>(&dib.vertical_ppm), 4)
-			.read(reinterpret_cast<char*>(&dib.color_num), 4)
-			.read(reinterpret_cast<char*>(&dib.important_color_num), 4);
+		return read_le(src, dib.size)
+			&& read_le(src, dib.width)
+			&& read_le(src, dib.height)
+			&& read_le(src, dib.colorplane_num)
+			&& read_le(src, dib.bitdepth)
+			&& read_le(src, dib.compress_method)
+			&& read_le(src, dib.raw_img_size)
+			&& read_le(src, dib.horizontal_ppm)
+			&& read_le(src, dib.vertical_ppm)
+			&& read_le(src, dib.color_num)
+			&& read_le(src, dib.important_color_num);
+	}
+
+	/// read channel masks and palette, source must be right after 40 bytes of DIB
+	std::error_code read_colors(ByteSource& src, Bmp& bmp)
+	{
+		const auto method = bmp.dib.compress_method;
+		const bool fields = method == CompressMethod::BI_BITFIELDS || method == CompressMethod::BI_ALPHABITFIELDS;
+		uint32_t masks_after = 0; // bytes of masks that follow 40 bytes DIB
+		if (fields) {
+			// V2 and later DIB hold masks at same place that follow 40 bytes DIB
+			for (auto& m : bmp.colors.mask) {
+				if (!read_le(src, m)) {
+					return BmpError::unexpected_eof;
+				}
+			}
+			if (bmp.dib.size == 40) {
+				masks_after = method == CompressMethod::BI_ALPHABITFIELDS ? 16 : 12;
+			}
+		}
+		else if (bmp.dib.bitdepth == BitDepth::bit16) {
+			bmp.colors.mask[0] = 0x7C00;
+			bmp.colors.mask[1] = 0x03E0;
+			bmp.colors.mask[2] = 0x001F;
+		}
+		else if (bmp.dib.bitdepth == BitDepth::bit32) {
+			bmp.colors.mask[0] = 0xFF'0000;
+			bmp.colors.mask[1] = 0xFF00;
+			bmp.colors.mask[2] = 0xFF;
+		}
+		if (!bmp.colors.update_masks()) {
+			return BmpError::invalid_bitfields;
+		}
+
+		const uint32_t depth = static_cast<uint32_t>(bmp.dib.bitdepth);
+		if (depth > 8) {
+			return {};
+		}
+		// palette follows DIB, 4 bytes per entry blue, green, red then unused
+		const uint64_t pos = 14ull + bmp.dib.size + masks_after;
+		if (pos < src.tell() || !src.skip(pos - src.tell())) {
+			return BmpError::unexpected_eof;
+		}
+		const uint32_t n = bmp.dib.color_num ? std::min(bmp.dib.color_num, 256u) : 1u << depth;
+		for (uint32_t i = 0; i < n; ++i) {
+			uint8_t e[4];
+			if (src.read(e, 4) != 4) {
+				return BmpError::unexpected_eof;
+			}
+			bmp.colors.palette[i] = { e[0], e[1], e[2] };
+		}
+		return {};
 	}
 
-	std::error_code read_meta(std::istream& is, Bmp& bmp)
+	/// width or height that can't be negated, or image that buffers of its rows or pixels can't hold
+	std::error_code check_size(const Bmp& bmp)
 	{
-		is >> bmp.header;
+		if (bmp.dib.width == 0 || bmp.dib.height == 0 || bmp.dib.width == INT32_MIN || bmp.dib.height == INT32_MIN) {
+			return BmpError::invalid_dimension;
+		}
+		const size_t h = bmp.height();
+		if (bmp.row_size() > UINT32_MAX || bmp.row_size() > SIZE_MAX / h || size_t{ bmp.width() } * sizeof(Rgb24) > SIZE_MAX / h) {
+			return BmpError::image_too_large;
+		}
+		return {};
+	}
 
-		if (bmp.signature() != "BM") {
-			is.setstate(std::ios::badbit);
+	std::error_code read_meta(ByteSource& src, Bmp& bmp)
+	{
+		if (!read_header(src, bmp.header) || bmp.signature() != "BM") {
 			return BmpError::unknow_signature;
 		}
-		is >> bmp.dib;
+		if (!read_dib(src, bmp.dib)) {
+			return BmpError::unexpected_eof;
+		}
 		
 		return {};
 	}
 
 	struct BmpFileReader {
-		BmpFileReader(const std::string& _path) :path{ _path }, ifs{ _path ,  std::ios::binary }, bmp{} {};
+		BmpFileReader(const std::string& _path) :path{ _path }, bmp{}, src{ open_source(_path) } {};
+
+		/// read from already opened source e.g. stdin
+		BmpFileReader(std::unique_ptr<ByteSource> _src) :path{}, bmp{}, src{ std::move(_src) } {};
 
 		std::error_code fetch_meta() {
-			if (!ifs.is_open()) {
+			if (!src) {
 				return BmpError::fail_open_file;
 			}
-			auto ec = read_meta(ifs, bmp);
+			auto ec = read_meta(*src, bmp);
 			if (ec) {
 				return ec;
 			}
-			if (bmp.dib.size != 40) {
+			// BITMAPINFOHEADER, V2, V3, V4 and V5
+			const uint32_t dib_size = bmp.dib.size;
+			if (dib_size != 40 && dib_size != 52 && dib_size != 56 && dib_size != 108 && dib_size != 124) {
 				return BmpError::dib_not_support;
 			}
-			if (bmp.dib.bitdepth != BitDepth::bit24) {
+			const auto depth = bmp.dib.bitdepth;
+			if (depth != BitDepth::bit1 && depth != BitDepth::bit4 && depth != BitDepth::bit8
+				&& depth != BitDepth::bit16 && depth != BitDepth::bit24 && depth != BitDepth::bit32) {
 				return BmpError::bitdepth_not_support;
 			}
-			if (bmp.dib.compress_method != CompressMethod::BI_RGB) {
+			ec = check_size(bmp);
+			if (ec) {
+				return ec;
+			}
+			switch (bmp.dib.compress_method)
+			{
+			case CompressMethod::BI_RGB:
+				break;
+			case CompressMethod::BI_RLE8:
+			case CompressMethod::BI_RLE4:
+				// RLE image is always bottom up
+				if (depth != (bmp.dib.compress_method == CompressMethod::BI_RLE8 ? BitDepth::bit8 : BitDepth::bit4) || bmp.top_down()) {
+					return BmpError::compression_method_not_support;
+				}
+				break;
+			case CompressMethod::BI_BITFIELDS:
+			case CompressMethod::BI_ALPHABITFIELDS:
+				if (depth != BitDepth::bit16 && depth != BitDepth::bit32) {
+					return BmpError::compression_method_not_support;
+				}
+				break;
+			default:
 				return BmpError::compression_method_not_support;
 			}
-			return {};
+			return read_colors(*src, bmp);
 		}
 
 		auto view() {
-			return BmpRowView{ ifs , bmp };
+			return BmpRowView{ *src , bmp };
 		}
 
 		const std::string path;
 		Bmp bmp;
-		std::ifstream ifs;
+		std::unique_ptr<ByteSource> src;
 
 	};
 
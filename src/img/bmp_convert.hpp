@@ -0,0 +1,95 @@
+#pragma once
+
+#include "pixel.hpp"
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <span>
+
+namespace img::bmp {
+
+	/// palette and channel masks of DIB, what row kernels need
+	struct Color_info {
+		/// entries after color count are black
+		Rgb24 palette[256]{};
+		/// red, green, blue masks of 16 and 32 bits pixels
+		uint32_t mask[3]{};
+		// from mask, see update_masks()
+		uint32_t shift[3]{};
+		uint32_t bits[3]{};
+		uint8_t scale[3][256]{}; // channel of at most 8 bits to 8 bits, rounded
+
+		/// call after masks are changed
+		/// @return false when any mask isn't contiguous
+		bool update_masks() {
+			for (int c = 0; c < 3; ++c) {
+				shift[c] = mask[c] ? std::countr_zero(mask[c]) : 0;
+				bits[c] = std::popcount(mask[c]);
+				if (mask[c] && (mask[c] >> shift[c]) != (bits[c] == 32 ? ~0u : (1u << bits[c]) - 1)) {
+					return false;
+				}
+				if (bits[c] && bits[c] <= 8) {
+					const uint32_t max = (1u << bits[c]) - 1;
+					for (uint32_t v = 0; v <= max; ++v) {
+						scale[c][v] = static_cast<uint8_t>((v * 255 + max / 2) / max);
+					}
+				}
+			}
+			return true;
+		}
+
+		/// channel `c` of pixel scaled to 8 bits, over 8 bits keep high bits
+		uint8_t channel(uint32_t px, int c) const {
+			const uint32_t v = (px & mask[c]) >> shift[c];
+			return bits[c] <= 8 ? scale[c][v] : static_cast<uint8_t>(v >> (bits[c] - 8));
+		}
+	};
+
+	/// expand one row of `width` pixels to Rgb24, `row` must hold every byte of those pixels
+	using expand_fn = void(*)(std::span<const uint8_t> row, Rgb24* dst, uint32_t width, const Color_info& colors);
+
+	namespace expand {
+
+		/// palette index of `BD` bits, packed from most significant bit
+		template<int BD>
+		void indexed(std::span<const uint8_t> row, Rgb24* dst, uint32_t width, const Color_info& colors) {
+			assert(row.size() >= (size_t{ width } * BD + 7) / 8);
+			for (uint32_t x = 0; x < width; ++x) {
+				if constexpr (BD == 8) {
+					dst[x] = colors.palette[row[x]];
+				}
+				else {
+					const size_t bit = size_t{ x } * BD;
+					dst[x] = colors.palette[(row[bit / 8] >> (8 - BD - bit % 8)) & ((1u << BD) - 1)];
+				}
+			}
+		}
+
+		/// 16 or 32 bits little endian pixels with channel masks
+		template<int BD>
+		void masked(std::span<const uint8_t> row, Rgb24* dst, uint32_t width, const Color_info& colors) {
+			assert(row.size() >= size_t{ width } * (BD / 8));
+			for (uint32_t x = 0; x < width; ++x) {
+				uint32_t px;
+				if constexpr (BD == 16) {
+					px = row[2 * x] | (uint32_t{ row[2 * x + 1] } << 8);
+				}
+				else {
+					const uint8_t* p = row.data() + 4 * x;
+					px = p[0] | (uint32_t{ p[1] } << 8) | (uint32_t{ p[2] } << 16) | (uint32_t{ p[3] } << 24);
+				}
+				dst[x].r = colors.channel(px, 0);
+				dst[x].g = colors.channel(px, 1);
+				dst[x].b = colors.channel(px, 2);
+			}
+		}
+
+		/// 32 bits with default masks, bytes are blue, green, red then unused
+		void bgrx(std::span<const uint8_t> row, Rgb24* dst, uint32_t width, const Color_info&) {
+			assert(row.size() >= size_t{ width } * 4);
+			for (uint32_t x = 0; x < width; ++x) {
+				dst[x] = { row[4 * x], row[4 * x + 1], row[4 * x + 2] };
+			}
+		}
+	}
+}
@@ -9,7 +9,11 @@ namespace img::bmp {
         dib_not_support,
         bitdepth_not_support,
         compression_method_not_support,
-        fail_open_file
+        fail_open_file,
+        unexpected_eof,
+        invalid_bitfields,
+        invalid_dimension,
+        image_too_large
     };
 
     struct BmpCategory : std::error_category
@@ -32,6 +36,14 @@ namespace img::bmp {
                 return "not support compression method";
             case BmpError::fail_open_file:
                 return "fail open file";
+            case BmpError::unexpected_eof:
+                return "unexpected end of file";
+            case BmpError::invalid_bitfields:
+                return "not valid BITFIELDS";
+            case BmpError::invalid_dimension:
+                return "not valid width or height";
+            case BmpError::image_too_large:
+                return "image too large";
             default:
                 return "unknown error";
             }
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMG_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+/// function attribute that allow instruction set for one function (gcc, clang)
+/// MSVC need no flag for intrinsics
+#if defined(IMG_X86) && (defined(__GNUC__) || defined(__clang__))
+#define IMG_TARGET(x) __attribute__((target(x)))
+#else
+#define IMG_TARGET(x)
+#endif
+
+namespace img::cpu
+{
+	/// instruction sets that usable at runtime
+	struct Features {
+		bool sse2 = false;
+		bool ssse3 = false;
+		bool sse41 = false;
+		bool avx2 = false;
+		bool pclmul = false;
+	};
+
+#if defined(IMG_X86)
+	inline void cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4]) {
+#if defined(_MSC_VER)
+		int regs[4];
+		__cpuidex(regs, static_cast<int>(leaf), static_cast<int>(sub));
+		for (int i = 0; i < 4; ++i) {
+			r[i] = static_cast<uint32_t>(regs[i]);
+		}
+#else
+		__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+	}
+
+	/// register state that OS saves on context switch
+	inline uint64_t xgetbv() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+	}
+
+	inline Features detect() {
+		Features f;
+		uint32_t r[4]{};
+		cpuid(0, 0, r);
+		const uint32_t max_leaf = r[0];
+		if (max_leaf < 1) {
+			return f;
+		}
+		cpuid(1, 0, r);
+		f.sse2 = r[3] & (1u << 26);
+		f.ssse3 = r[2] & (1u << 9);
+		f.sse41 = r[2] & (1u << 19);
+		f.pclmul = r[2] & (1u << 1);
+		const bool os_avx = (r[2] & (1u << 27)) && (r[2] & (1u << 28)) && (xgetbv() & 0x6) == 0x6;
+		if (max_leaf >= 7) {
+			cpuid(7, 0, r);
+			f.avx2 = os_avx && (r[1] & (1u << 5));
+		}
+		return f;
+	}
+#else
+	inline Features detect() {
+		return {};
+	}
+#endif
+
+	/// detected once on first use
+	inline const Features& features() {
+		static const Features f = detect();
+		return f;
+	}
+}
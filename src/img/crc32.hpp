@@ -0,0 +1,119 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/// CRC-32 of PNG chunks (ISO-HDLC, same as zlib crc32())
+namespace img
+{
+	namespace crc {
+		/// reflected polynomial
+		constexpr uint32_t POLY = 0xEDB8'8320;
+
+		/// `TABLE[k][b]` is CRC of byte `b` followed by `k` zero bytes, for slice by 8
+		constexpr auto TABLE = [] {
+			std::array<std::array<uint32_t, 256>, 8> t{};
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k) {
+					c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+				}
+				t[0][i] = c;
+			}
+			for (size_t k = 1; k < 8; ++k) {
+				for (uint32_t i = 0; i < 256; ++i) {
+					t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+				}
+			}
+			return t;
+		}();
+
+		/// 8 bytes per step, `crc` is inverted state
+		inline uint32_t slice8(uint32_t crc, const uint8_t* p, size_t n) {
+			for (; n >= 8; p += 8, n -= 8) {
+				const uint32_t lo = (p[0] | (uint32_t{ p[1] } << 8) | (uint32_t{ p[2] } << 16) | (uint32_t{ p[3] } << 24)) ^ crc;
+				crc = TABLE[7][lo & 0xFF] ^ TABLE[6][(lo >> 8) & 0xFF] ^ TABLE[5][(lo >> 16) & 0xFF] ^ TABLE[4][lo >> 24]
+					^ TABLE[3][p[4]] ^ TABLE[2][p[5]] ^ TABLE[1][p[6]] ^ TABLE[0][p[7]];
+			}
+			for (; n; ++p, --n) {
+				crc = TABLE[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+			}
+			return crc;
+		}
+	}
+
+#if defined(IMG_X86)
+	namespace kernel {
+		/// `a` times low half of `k` ^ `a` times high half of `k` ^ `b`, carry-less
+		IMG_TARGET("pclmul,sse4.1") inline __m128i crc_fold(__m128i a, __m128i k, __m128i b) {
+			return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x00), _mm_clmulepi64_si128(a, k, 0x11)), b);
+		}
+
+		/// fold 4 lanes of 128 bits with carry-less multiply then Barrett reduce,
+		/// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel)
+		/// @param n at least 64 and multiple of 16
+		/// @param crc inverted state
+		IMG_TARGET("pclmul,sse4.1") inline uint32_t crc32_pclmul(const uint8_t* p, size_t n, uint32_t crc) {
+			alignas(16) static constexpr uint64_t k1k2[] = { 0x1'5444'2bd4, 0x1'c6e4'1596 };
+			alignas(16) static constexpr uint64_t k3k4[] = { 0x1'7519'97d0, 0x0'ccaa'009e };
+			alignas(16) static constexpr uint64_t k5k0[] = { 0x1'63cd'6124, 0 };
+			alignas(16) static constexpr uint64_t poly[] = { 0x1'db71'0641, 0x1'f701'1641 };
+			auto load = [](const uint8_t* q) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(q)); };
+
+			__m128i x1 = _mm_xor_si128(load(p), _mm_cvtsi32_si128(static_cast<int>(crc)));
+			__m128i x2 = load(p + 16);
+			__m128i x3 = load(p + 32);
+			__m128i x4 = load(p + 48);
+			p += 64;
+			n -= 64;
+
+			__m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+			for (; n >= 64; p += 64, n -= 64) {
+				x1 = crc_fold(x1, k, load(p));
+				x2 = crc_fold(x2, k, load(p + 16));
+				x3 = crc_fold(x3, k, load(p + 32));
+				x4 = crc_fold(x4, k, load(p + 48));
+			}
+
+			k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+			x1 = crc_fold(x1, k, x2);
+			x1 = crc_fold(x1, k, x3);
+			x1 = crc_fold(x1, k, x4);
+			for (; n >= 16; p += 16, n -= 16) {
+				x1 = crc_fold(x1, k, load(p));
+			}
+
+			// 128 to 64 bits
+			const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+			x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k, 0x10));
+			k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+			x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), _mm_srli_si128(x1, 4));
+
+			// Barrett reduction to 32 bits
+			k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+			__m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+			t = _mm_clmulepi64_si128(_mm_and_si128(t, mask), k, 0x00);
+			return static_cast<uint32_t>(_mm_extract_epi32(_mm_xor_si128(x1, t), 1));
+		}
+	}
+#endif
+
+	/// continue `crc` of previous bytes with `data`, start with 0
+	inline uint32_t crc32(uint32_t crc, std::span<const uint8_t> data) {
+		const uint8_t* p = data.data();
+		size_t n = data.size();
+		crc = ~crc;
+#if defined(IMG_X86)
+		if (n >= 64 && cpu::features().pclmul && cpu::features().sse41) {
+			const size_t m = n & ~size_t{ 15 };
+			crc = kernel::crc32_pclmul(p, m, crc);
+			p += m;
+			n -= m;
+		}
+#endif
+		return ~crc::slice8(crc, p, n);
+	}
+}
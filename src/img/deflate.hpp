@@ -4,6 +4,11 @@
 #include <vector>
 #include <memory>
 #include <cmath>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <algorithm>
+#include "source.hpp"
 
 /// most code come from https://github.com/madler/zlib/blob/master/contrib/puff/puff.c
 namespace img::deflate
@@ -39,24 +44,6 @@ namespace img::deflate
 		reserved
 	};
 
-	template <typename T>
-	struct CircularBuffer {
-		using container_type = std::vector<T>;
-
-		CircularBuffer(size_t n) : m_size{ n }, m_mask{ n - 1 }, data(n) {
-		}
-
-		T& operator[](std::ptrdiff_t index) { return data[index & m_mask]; }
-
-		size_t size() const { return m_size; }
-	private:
-		size_t m_mask;
-		size_t m_size;
-		container_type data;
-	};
-
-	using window_t = CircularBuffer<uint8_t>;
-
 	union Header {
 		uint16_t data;
 		struct {
@@ -72,17 +59,43 @@ namespace img::deflate
 		return 1ull << (8 + cifo);
 	}
 
-	struct Huffman {
-		constexpr Huffman(size_t ncnt, size_t nsym) :count(ncnt, 0), symbol(nsym, 0)
-		{
+	/// lookup table entry, either a decoded symbol or a link to a sub table
+	struct HuffCode {
+		uint16_t value = 0; // symbol, or offset of sub table when `sub` isn't 0
+		uint8_t bits = 0; // bits to drop, 0 mean invalid code
+		uint8_t sub = 0; // index bits of sub table
+	};
+
+	/// root table index bits, codes that longer than this are placed in sub tables
+	constexpr int LENBITS = 9;
+	constexpr int DISTBITS = 6;
+	/// max table size for any valid code (same value as zlib's inftrees.h)
+	constexpr size_t ENOUGH_LENS = 852;
+	constexpr size_t ENOUGH_DISTS = 592;
+
+	constexpr uint32_t reverse_bits(uint32_t code, int len) {
+		uint32_t ret = 0;
+		for (int i = 0; i < len; ++i) {
+			ret = (ret << 1) | (code & 1);
+			code >>= 1;
 		}
-		int build(int16_t* length, int n) {
+		return ret;
+	}
+
+	template<int ROOT, size_t ENOUGH>
+	struct Huffman {
+		static constexpr int root = ROOT;
+
+		constexpr int build(const int16_t* length, int n) {
 			for (int len = 0; len <= MAXBITS; len++) {
 				count[len] = 0;
 			}
 			for (int sym = 0; sym < n; sym++) {
 				count[length[sym]]++;
 			}
+			for (size_t i = 0; i < (1u << ROOT); ++i) {
+				table[i] = {};
+			}
 			if (count[0] == n) {
 				return 0;
 			}
@@ -103,73 +116,243 @@ namespace img::deflate
 					symbol[off[length[sym]]++] = sym;
 				}
 			}
+			if (!build_table()) {
+				return -1;
+			}
 			return left;
 		}
 
-		std::vector<int16_t> count;
-		std::vector<int16_t> symbol;
+		std::array<int16_t, MAXBITS + 1> count{};
+		std::array<int16_t, FIXLCODES> symbol{};
+		std::array<HuffCode, ENOUGH> table{};
+
+	private:
+		/// fill lookup table from canonical code of `count` and `symbol`
+		/// codes are stored bit reversed because deflate pack them from MSB
+		constexpr bool build_table() {
+			constexpr uint32_t mask = (1u << ROOT) - 1;
+			uint32_t first[MAXBITS + 1]{}; // first canonical code of each length
+			for (int len = 1; len <= MAXBITS; ++len) {
+				first[len] = (first[len - 1] + (len > 1 ? count[len - 1] : 0)) << 1;
+			}
+
+			// find longest code of each root prefix for sizing sub tables
+			uint8_t longest[1u << ROOT]{};
+			uint32_t next[MAXBITS + 1]{};
+			int index = 0;
+			for (int len = 1; len <= MAXBITS; ++len) {
+				next[len] = first[len];
+				for (int i = 0; i < count[len]; ++i, ++index) {
+					uint32_t rev = reverse_bits(next[len]++, len);
+					if (len > ROOT) {
+						longest[rev & mask] = static_cast<uint8_t>(len);
+					}
+				}
+			}
+
+			size_t used = 1u << ROOT;
+			for (uint32_t p = 0; p <= mask; ++p) {
+				if (longest[p] == 0) {
+					continue;
+				}
+				int sub = longest[p] - ROOT;
+				if (used + (1u << sub) > ENOUGH) {
+					return false;
+				}
+				table[p] = { static_cast<uint16_t>(used), static_cast<uint8_t>(ROOT), static_cast<uint8_t>(sub) };
+				for (size_t i = 0; i < (1u << sub); ++i) {
+					table[used + i] = {};
+				}
+				used += 1u << sub;
+			}
+
+			index = 0;
+			for (int len = 1; len <= MAXBITS; ++len) {
+				next[len] = first[len];
+				for (int i = 0; i < count[len]; ++i, ++index) {
+					uint16_t sym = static_cast<uint16_t>(symbol[index]);
+					uint32_t rev = reverse_bits(next[len]++, len);
+					if (len <= ROOT) {
+						for (uint32_t k = rev; k <= mask; k += 1u << len) {
+							table[k] = { sym, static_cast<uint8_t>(len), 0 };
+						}
+					}
+					else {
+						const HuffCode link = table[rev & mask];
+						const int drop = len - ROOT;
+						for (uint32_t k = rev >> ROOT; k < (1u << link.sub); k += 1u << drop) {
+							table[link.value + k] = { sym, static_cast<uint8_t>(drop), 0 };
+						}
+					}
+				}
+			}
+			return true;
+		}
 	};
 
+	using LenHuffman = Huffman<LENBITS, ENOUGH_LENS>;
+	using DistHuffman = Huffman<DISTBITS, ENOUGH_DISTS>;
+
 	struct Lz77code {
-		Lz77code(size_t nlen, size_t ndist) :
-			lencode{ MAXBITS + 1 , nlen }, 
-			distcode{ MAXBITS + 1 , ndist } {}
-		Huffman lencode;
-		Huffman distcode;
+		LenHuffman lencode;
+		DistHuffman distcode;
 	};
 
+	/// fixed huffman code of block type 01
+	constexpr Lz77code make_fixed_lz77() {
+		Lz77code lz{};
+		int16_t lengths[FIXLCODES]{};
+		int sym = 0;
+		for (; sym < 144; ++sym) { lengths[sym] = 8; }
+		for (; sym < 256; ++sym) { lengths[sym] = 9; }
+		for (; sym < 280; ++sym) { lengths[sym] = 7; }
+		for (; sym < FIXLCODES; ++sym) { lengths[sym] = 8; }
+		lz.lencode.build(lengths, FIXLCODES);
+
+		for (sym = 0; sym < MAXDCODES; ++sym) { lengths[sym] = 5; }
+		lz.distcode.build(lengths, MAXDCODES);
+		return lz;
+	}
+
+	constexpr Lz77code fixed_lz77 = make_fixed_lz77();
+
+	/// unaligned little endian load
+	inline uint64_t load_le64(const uint8_t* p) {
+		uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		if constexpr (std::endian::native == std::endian::big) {
+			uint64_t r = 0;
+			for (int i = 0; i < 8; ++i) {
+				r |= static_cast<uint64_t>(p[i]) << (i * 8);
+			}
+			v = r;
+		}
+		return v;
+	}
+
+	/// bit reader with 64 bits accumulator, input is taken from source in bulk
 	struct InflateStream
 	{
-		InflateStream(std::istream& is) :m_is{ is } {}
+		static constexpr size_t INPUT_SIZE = 1 << 15;
 
-		int read_code(const Huffman& h) {
-			int code = 0, first = 0, index = 0;
+		InflateStream(ByteSource& src) :m_src{ src } {}
 
-			for (int len = 1; len <= MAXBITS; ++len) {
-				code |= read_bits(1);
-				int count = h.count[len];
-				if (code - count < first) {
-					return h.symbol[index + (code - first)];
-				}
-				index += count;
-				first += count;
-				first <<= 1;
-				code <<= 1;
+		/// decode one symbol by table lookup, sub table is used only for long codes
+		template<int ROOT, size_t ENOUGH>
+		int read_code(const Huffman<ROOT, ENOUGH>& h) {
+			HuffCode code = h.table[peek_bits(MAXBITS) & ((1u << ROOT) - 1)];
+			if (code.sub) {
+				drop_bits(ROOT);
+				code = h.table[code.value + (bits_buf & ((1u << code.sub) - 1))];
 			}
-
-			return -10;
+			if (code.bits == 0) {
+				return -10;
+			}
+			drop_bits(code.bits);
+			return code.value;
 		}
 
-	
+		/// look at next `n` bits without consume them, zeros are padded after end of stream
 		/// @param n must not over 32
-		uint32_t read_bits(int n) {
-			while (bit_avail < n) {
-				read_to(byte_buf); // read unformated 1 byte 
-				bits_buf |= (byte_buf << bit_avail);
-				bit_avail += 8;
+		uint32_t peek_bits(int n) {
+			if (bit_avail < n) {
+				refill();
 			}
+			return static_cast<uint32_t>(bits_buf & ((1ull << n) - 1));
+		}
 
-			uint32_t ret = bits_buf & ~(-1u << n);// -1u = 0xffff... = 0b1111...
-
+		void drop_bits(int n) {
 			bits_buf >>= n;
 			bit_avail -= n;
+		}
 
+		/// @param n must not over 32
+		uint32_t read_bits(int n) {
+			uint32_t ret = peek_bits(n);
+			drop_bits(n);
 			return ret;
 		}
 
+		/// discard bits until next byte boundary
+		void align_byte() {
+			drop_bits(bit_avail & 7);
+		}
+
+		/// copy byte aligned data, must call align_byte() first
+		/// @return number of bytes copied, less than `n` only at end of stream
+		size_t read_bytes(uint8_t* dst, size_t n) {
+			size_t done = 0;
+			// bytes that already in accumulator come first
+			while (done < n && bit_avail >= 8 && bit_avail > overrun * 8) {
+				dst[done++] = static_cast<uint8_t>(bits_buf);
+				drop_bits(8);
+			}
+			if (bit_avail > 0) {
+				return done;
+			}
+			bits_buf = 0; // drop look ahead bits, input is consumed directly from now
+			while (done < n) {
+				if (m_next == m_end && !fill_input()) {
+					break;
+				}
+				size_t k = std::min(n - done, static_cast<size_t>(m_end - m_next));
+				std::memcpy(dst + done, m_next, k);
+				m_next += k;
+				done += k;
+			}
+			return done;
+		}
+
 		template<typename T, size_t N = sizeof(T)>
 		void read_to(T& b) {
-			m_is.read(reinterpret_cast<char*>(&b), N);
+			read_bytes(reinterpret_cast<uint8_t*>(&b), N);
 		}
 
+		/// false when decoder consume bits after end of stream
 		bool good() const {
-			return m_is.good();
+			return overrun * 8 <= bit_avail;
+		}
+
+		/// true when every bit of input is consumed
+		bool exhausted() {
+			return bit_avail <= overrun * 8 && m_next == m_end && !fill_input();
 		}
 	private:
-		uint8_t byte_buf = 0;
-		uint32_t bits_buf = 0;
-		uint8_t bit_avail = 0;
-		std::istream& m_is;
+		/// top up accumulator to at least 56 bits, bits above `bit_avail` may hold
+		/// part of next byte which is consistent with what next refill will put there
+		void refill() {
+			if (m_end - m_next >= 8) {
+				bits_buf |= load_le64(m_next) << bit_avail;
+				m_next += (63 - bit_avail) >> 3;
+				bit_avail |= 56;
+				return;
+			}
+			while (bit_avail <= 56) {
+				uint64_t byte = 0;
+				if (m_next != m_end || fill_input()) {
+					byte = *m_next++;
+				}
+				else {
+					++overrun;
+				}
+				bits_buf |= byte << bit_avail;
+				bit_avail += 8;
+			}
+		}
+
+		bool fill_input() {
+			bytes_view in = m_src.take(INPUT_SIZE);
+			m_next = in.data();
+			m_end = m_next + in.size();
+			return m_next != m_end;
+		}
+
+		uint64_t bits_buf = 0;
+		int bit_avail = 0;
+		int overrun = 0; // number of zero bytes padded after end of stream
+		ByteSource& m_src;
+		const uint8_t* m_next = nullptr;
+		const uint8_t* m_end = nullptr;
 	};
 
 
@@ -181,20 +364,18 @@ namespace img::deflate
 	}
 
 	using Lz77code_ptr = std::unique_ptr<Lz77code>;
-	using Lz77_read_result = std::pair<int, Lz77code_ptr>; // error code, table
 
 
-	/// dynamic huffman
-	Lz77_read_result read_lz77(InflateStream& is) {
-		
-		auto lz = std::make_unique<Lz77code>(MAXLCODES, MAXDCODES);
+	/// dynamic huffman, tables of `lz` are rebuilt so it can be reused between blocks
+	/// @return error code
+	int read_lz77(InflateStream& is, Lz77code& lz) {
 
 		int nlen = is.read_bits(5) + 257;
 		int ndist = is.read_bits(5) + 1;
 		int ncode = is.read_bits(4) + 4;
 
 		if (nlen > MAXLCODES || ndist > MAXDCODES) {
-			return {-3, nullptr};
+			return -3;
 		}
 
 		std::vector<int16_t> lengths(MAXCODES, 0); /* descriptor code lengths */
@@ -204,19 +385,19 @@ namespace img::deflate
 			lengths[order[index]] = is.read_bits(3);
 		}
 
-		int err = lz->lencode.build(lengths.data(), 19);
+		int err = lz.lencode.build(lengths.data(), 19);
 		
 		if (err) {
-			return { -4, nullptr };
+			return -4;
 		}
 
 		index = 0;
 		int codelen = nlen + ndist;
 		while (index < codelen) {
 
-			int sym = is.read_code(lz->lencode);
+			int sym = is.read_code(lz.lencode);
 			if (sym < 0) {
-				return { -99, nullptr };
+				return -99;
 			}
 			if (sym < 16) {
 				lengths[index++] = sym;
@@ -225,7 +406,7 @@ namespace img::deflate
 				int len = 0;
 
 				if (sym == 16) {         /* repeat last length 3..6 times */
-					if (index == 0) { return {}; }      /* no last length! */
+					if (index == 0) { return -5; }      /* no last length! */
 					len = lengths[index - 1];       /* last length */
 					sym = 3 + is.read_bits(2);
 				}
@@ -236,7 +417,7 @@ namespace img::deflate
 					sym = 11 + is.read_bits(7);
 				}
 				if (index + sym > codelen) {
-					return { -6, nullptr };
+					return -6;
 				}
 				while (sym--)            /* repeat last or zero symbol times */
 					lengths[index++] = len;
@@ -245,115 +426,37 @@ namespace img::deflate
 		}
 
 		if (lengths[256] == 0)
-			 return { -9, nullptr };
+			 return -9;
 
-		err = lz->lencode.build(lengths.data(), nlen);
+		err = lz.lencode.build(lengths.data(), nlen);
 
-		if (err && (err < 0 || nlen != lz->lencode.count[0] + lz->lencode.count[1])) {
-			 return { -7, nullptr };
+		if (err && (err < 0 || nlen != lz.lencode.count[0] + lz.lencode.count[1])) {
+			 return -7;
 		}
 
-		err = lz->distcode.build(lengths.data() + nlen, ndist);
+		err = lz.distcode.build(lengths.data() + nlen, ndist);
 
-		if (err && (err < 0 || ndist != lz->distcode.count[0] + lz->distcode.count[1]))
-			return { -8, nullptr };      /* only allow incomplete codes if just one code */
-
-		return { 0, std::move(lz) };
-	}
-
-	template<typename OUT_IT>
-		requires std::output_iterator<OUT_IT, uint8_t>
-	int decode_lz77(InflateStream& is,  OUT_IT it, const Lz77code& lz, window_t& window) {
-
-		int32_t symbol;         /* decoded symbol */
-		uint32_t len;            /* length for copy */
-		uint32_t dist;      /* distance for copy */
-		size_t outcnt = 0;
-
-		do {
-			symbol = is.read_code(lz.lencode);
-			if (symbol < 0) {
-				return symbol;
-			}
-			if (symbol < 256) {
-				window[outcnt] = symbol;
-				*it++ = window[outcnt];
-				outcnt++;
-			}
-			else if (symbol > 256) {
-				symbol -= 257;
-
-				if (symbol >= 29) { return -9; }; //invalid fixed code
-
-				len = lens[symbol] + is.read_bits(lext[symbol]);
-				symbol = is.read_code(lz.distcode);
-
-				if (symbol < 0) { return symbol; }     /* invalid symbol */
-				dist = dists[symbol] + is.read_bits(dext[symbol]);
-
-				if (dist > outcnt || dist > window.size()) {
-					return -11;
-				}
-				
-				while (len--) {
-
-					window[outcnt] = window[outcnt - dist];
-					*it++ = window[outcnt];
-					outcnt++;
-				}
-			}
-		} while (symbol != 256);
+		if (err && (err < 0 || ndist != lz.distcode.count[0] + lz.distcode.count[1]))
+			return -8;      /* only allow incomplete codes if just one code */
 
 		return 0;
 	}
 
-	template<typename OUT_IT>
-		requires std::output_iterator<OUT_IT, uint8_t>
-	int decode_blocks(InflateStream& is, OUT_IT it, size_t window_size) {
-		window_t window{ window_size };
-		while (is.good()) {
-			bool bfinal = is.read_bits(1);
-			BlockType btype = static_cast<BlockType>(is.read_bits(2));
-			switch (btype) {
-				case BlockType::reserved:
-				case BlockType::no_compress:
-				case BlockType::fixed:
-					return -20; //not support yet
-				case BlockType::dynamic: {
-					auto result = read_lz77(is);
-					if (result.first) {
-						return result.first;
-					}
-					auto ec = decode_lz77(is, it, *result.second, window);
-					if (ec) {
-						return ec;
-					}
-					break;
-				}
-			}
-			if (bfinal)
-			{
-				return 0;
-			}
-		}
-
-		return -20;
-	}
+	using Stored_read_result = std::pair<int, uint16_t>; // error code, length
 
-	/// concrete fucntion
-	template<typename OUT_IT> 
-		requires std::output_iterator<OUT_IT, uint8_t>
-	int inflate(std::istream& in, OUT_IT it) {
-		InflateStream is{in};
-		auto header = read_head(is);
-
-		if (header.CF != 8
-			|| header.CINFO > 7
-			|| header.FDICT != 0) {
-			return -20;
+	/// header of stored block
+	Stored_read_result read_stored(InflateStream& is) {
+		is.align_byte();
+		uint8_t head[4];
+		if (is.read_bytes(head, 4) != 4) {
+			return { -20, 0 };
 		}
-
-		return decode_blocks(is, it, deflate_window_size(header.CINFO));
+		uint16_t len = head[0] | (head[1] << 8);
+		uint16_t nlen = head[2] | (head[3] << 8);
+		if (len != static_cast<uint16_t>(~nlen)) {
+			return { -2, 0 };
+		}
+		return { 0, len };
 	}
 
 }
\ No newline at end of file
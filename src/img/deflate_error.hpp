@@ -16,6 +16,7 @@ namespace img::deflate
         dynamic_huffman_no_first_length,
         dynamic_huffman_incomplete_code_length,
         dynamic_huffman_to_many_length_or_distance,
+        stored_length_mismatch,
         invalid_block = -1,
         success = 0
     };
@@ -50,6 +51,8 @@ namespace img::deflate
                 return "code lengths codes incomplete";
             case DeflateError::dynamic_huffman_to_many_length_or_distance:
                 return "too many length or distance codes";
+            case DeflateError::stored_length_mismatch:
+                return "stored block length did not match one's complement";
             case DeflateError::invalid_block:
                 return "invalid block type";
             default:
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "format_error.hpp"
+#include "source.hpp"
+#include <string_view>
+
+/// image format from its first bytes, so file is opened and parsed by its own decoder only
+namespace img
+{
+	enum struct Format :uint8_t {
+		unknown,
+		bmp,
+		png,
+	};
+
+	struct Signature {
+		Format format;
+		std::string_view magic;
+	};
+
+	/// magic bytes at start of file, new format add its own here
+	constexpr Signature SIGNATURES[] = {
+		{ Format::png, std::string_view{ "\x89PNG\r\n\x1a\n", 8 } },
+		{ Format::bmp, "BM" },
+	};
+
+	/// bytes that every signature fit in
+	constexpr size_t SNIFF_SIZE = 8;
+
+	/// @param head first bytes of file, shorter than SNIFF_SIZE only when file is
+	inline Format sniff(bytes_view head) {
+		for (const auto& sig : SIGNATURES) {
+			if (head.size() >= sig.magic.size() && std::equal(sig.magic.begin(), sig.magic.end(), head.begin(),
+				[](char m, uint8_t b) { return static_cast<uint8_t>(m) == b; })) {
+				return sig.format;
+			}
+		}
+		return Format::unknown;
+	}
+
+	/// peek first bytes of source then go back to where it was, so decoder read from start
+	inline Format sniff(ByteSource& src) {
+		const uint64_t start = src.tell();
+		uint8_t head[SNIFF_SIZE];
+		const size_t n = src.read(head, SNIFF_SIZE);
+		if (!src.seek(start)) {
+			return Format::unknown;
+		}
+		return sniff(bytes_view{ head, n });
+	}
+}
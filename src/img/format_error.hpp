@@ -0,0 +1,50 @@
+#pragma once
+
+#include <system_error>
+
+namespace img {
+    enum struct FormatError
+    {
+        fail_open_file = 10,
+        unknown_format
+    };
+
+    struct FormatCategory : std::error_category
+    {
+        const char* name() const noexcept override
+        {
+            return "format_error";
+        }
+        std::string message(int value) const override
+        {
+            switch (static_cast<FormatError>(value))
+            {
+            case FormatError::fail_open_file:
+                return "can't open file";
+            case FormatError::unknown_format:
+                return "not bmp nor png";
+            default:
+                return "unknown error";
+            }
+        }
+    };
+
+    std::error_category& format_category()
+    {
+        static FormatCategory cate{};
+        return cate;
+    }
+
+    std::error_code make_error_code(FormatError value)
+    {
+        return { static_cast<int>(value), format_category() };
+    }
+}
+
+namespace std
+{
+    template <>
+    struct is_error_code_enum<img::FormatError> : true_type
+    {
+    };
+}
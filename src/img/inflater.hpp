@@ -0,0 +1,358 @@
+#pragma once
+
+#include "deflate_error.hpp"
+#include "deflate.hpp"
+#include <span>
+
+namespace img::deflate
+{
+	/// max bytes that copy_match() may write after end of match
+	constexpr size_t COPY_SLACK = 16;
+
+	/// copy `len` bytes of match from `dist` bytes back in wide steps
+	/// overlapping is handled by step size, short distance repeat the pattern
+	/// @param dst must be writable for `len + COPY_SLACK` bytes
+	inline void copy_match(uint8_t* dst, size_t dist, size_t len) {
+		const uint8_t* src = dst - dist;
+		uint8_t* const end = dst + len;
+		if (dist >= 16) {
+			do {
+				std::memcpy(dst, src, 16);
+				dst += 16;
+				src += 16;
+			} while (dst < end);
+		}
+		else if (dist >= 8) {
+			do {
+				std::memcpy(dst, src, 8);
+				dst += 8;
+				src += 8;
+			} while (dst < end);
+		}
+		else if (dist == 1) {
+			std::memset(dst, *src, len);
+		}
+		else {
+			uint8_t pattern[8];
+			for (size_t i = 0; i < 8; ++i) {
+				pattern[i] = src[i % dist];
+			}
+			const size_t step = 8 - 8 % dist; // whole patterns per store
+			do {
+				std::memcpy(dst, pattern, 8);
+				dst += step;
+			} while (dst < end);
+		}
+	}
+
+	/// resumable inflater that write decompressed bytes into caller's buffer chunk by chunk
+	struct Inflater
+	{
+		/// bytes decoded after window before it slides
+		static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+		/// allocations that can be handed from one inflater to next one
+		struct Buffers {
+			std::vector<uint8_t> buf;
+			Lz77code_ptr dynamic;
+		};
+
+		Inflater(ByteSource& src) : m_is{ src } {}
+
+		/// @param segment raw deflate data without zlib header that start at block boundary,
+		/// it may end at any block boundary without final block
+		Inflater(ByteSource& src, bool segment) : m_is{ src }, m_segment{ segment } {
+			if (segment) {
+				m_window = deflate_window_size(7);
+				m_state = State::block;
+			}
+		}
+
+		/// segment that may refer to bytes before it, for read() only
+		/// @param dict output right before segment, only last window of it is kept
+		Inflater(ByteSource& src, bytes_view dict) : Inflater{ src, true } {
+			dict = dict.last(std::min(dict.size(), m_window));
+			m_buf.resize(m_window + CHUNK_SIZE);
+			if (!dict.empty()) {
+				std::memcpy(m_buf.data(), dict.data(), dict.size());
+			}
+			m_dst = m_buf.data();
+			m_cap = m_buf.size();
+			m_pos = dict.size();
+			m_out = dict.size();
+		}
+
+		/// @return number of bytes written, less than `out.size()` only when stream is ended
+		size_t read(std::span<uint8_t> out) {
+			size_t done = 0;
+			while (done < out.size()) {
+				if (m_out == m_pos) {
+					if (m_state == State::done) {
+						break;
+					}
+					fill();
+					continue;
+				}
+				size_t n = std::min(out.size() - done, m_pos - m_out);
+				std::memcpy(out.data() + done, m_dst + m_out, n);
+				m_out += n;
+				done += n;
+			}
+			return done;
+		}
+
+		/// decode whole stream straight into `out` without window, back references
+		/// are copied within `out` itself, must not mix with read()
+		/// @return number of bytes written, decoding stops when `out` is full
+		size_t read_all(std::span<uint8_t> out) {
+			if (m_state == State::header) {
+				read_header();
+			}
+			m_dst = out.data();
+			m_cap = out.size();
+			m_pos = 0;
+			while (m_pos < m_cap && m_state != State::done) {
+				step();
+			}
+			m_out = m_pos;
+			return m_pos;
+		}
+
+		/// true when every byte of stream has been read
+		bool done() const {
+			return m_state == State::done && m_out == m_pos;
+		}
+
+		/// true when final block has been reached
+		bool final_block() const {
+			return m_final;
+		}
+
+		/// use allocations of previous inflater, must be called before any read
+		void adopt(Buffers&& b) {
+			m_buf = std::move(b.buf);
+			m_dynamic = std::move(b.dynamic);
+		}
+
+		/// give allocations back for next inflater, this inflater must not be used after
+		Buffers release() {
+			return { std::move(m_buf), std::move(m_dynamic) };
+		}
+
+	private:
+		enum struct State :uint8_t {
+			header,
+			block,
+			stored,
+			huffman,
+			done
+		};
+
+		/// decode until buffer is full or stream is ended
+		void fill() {
+			if (m_state == State::header) {
+				read_header();
+			}
+			if (!m_dst) {
+				m_buf.resize(m_window + CHUNK_SIZE);
+				m_dst = m_buf.data();
+				m_cap = m_buf.size();
+			}
+			if (m_pos == m_cap) {
+				slide();
+			}
+			while (m_pos < m_cap && m_state != State::done) {
+				step();
+			}
+		}
+
+		void step() {
+			switch (m_state) {
+			case State::block:
+				read_block_head();
+				break;
+			case State::stored:
+				decode_stored();
+				break;
+			case State::huffman:
+				decode_huffman();
+				break;
+			default:
+				break;
+			}
+		}
+
+		/// keep only last window of decoded bytes at front of buffer
+		void slide() {
+			size_t keep = std::min(m_pos, m_window);
+			std::memmove(m_dst, m_dst + m_pos - keep, keep);
+			m_pos = keep;
+			m_out = keep;
+		}
+
+		void read_header() {
+			auto header = read_head(m_is);
+			if (header.CF != 8
+				|| header.CINFO > 7
+				|| header.FDICT != 0) {
+				throw std::system_error(make_error_code(DeflateError::general_error));
+			}
+			m_window = deflate_window_size(header.CINFO);
+			m_state = State::block;
+		}
+
+		void read_block_head() {
+			if (m_final || (m_segment && m_is.exhausted())) {
+				m_state = State::done;
+				return;
+			}
+			if (!m_is.good()) {
+				throw std::system_error(make_error_code(DeflateError::general_error));
+			}
+			m_final = m_is.read_bits(1);
+			BlockType btype = static_cast<BlockType>(m_is.read_bits(2));
+			switch (btype) {
+			case BlockType::no_compress: {
+				auto [ec, len] = read_stored(m_is);
+				if (ec) {
+					throw std::system_error(make_error_code(static_cast<DeflateError>(ec)));
+				}
+				m_stored_left = len;
+				m_state = State::stored;
+				break;
+			}
+			case BlockType::fixed:
+				m_lz = &fixed_lz77;
+				m_state = State::huffman;
+				break;
+			case BlockType::dynamic: {
+				if (!m_dynamic) {
+					m_dynamic = std::make_unique<Lz77code>();
+				}
+				if (int ec = read_lz77(m_is, *m_dynamic)) {
+					throw std::system_error(make_error_code(static_cast<DeflateError>(ec)));
+				}
+				m_lz = m_dynamic.get();
+				m_state = State::huffman;
+				break;
+			}
+			default:
+				throw std::system_error(make_error_code(DeflateError::invalid_block));
+			}
+		}
+
+		void decode_stored() {
+			size_t n = std::min(m_stored_left, m_cap - m_pos);
+			if (m_is.read_bytes(m_dst + m_pos, n) != n) {
+				throw std::system_error(make_error_code(DeflateError::general_error));
+			}
+			m_pos += n;
+			m_stored_left -= n;
+			if (m_stored_left == 0) {
+				m_state = State::block;
+			}
+		}
+
+		/// fixed or dynamic block, a match that doesn't fit is continued on next call
+		void decode_huffman() {
+			uint8_t* const out = m_dst;
+			const size_t end = m_cap;
+			size_t pos = m_pos;
+
+			if (m_copy_len) {
+				pos = copy_pending(pos);
+			}
+
+			// fast path, any match fits so it can be copied in wide steps
+			while (end - pos >= 258 + COPY_SLACK && m_is.good()) {
+				int symbol = m_is.read_code(m_lz->lencode);
+				if (symbol < 256) {
+					if (symbol < 0) {
+						throw std::system_error(make_error_code(DeflateError::invalid_huffman_code));
+					}
+					out[pos++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+				if (symbol == 256) {
+					m_state = State::block;
+					m_pos = pos;
+					return;
+				}
+				read_match(symbol, pos);
+				copy_match(out + pos, m_dist, m_copy_len);
+				pos += m_copy_len;
+				m_copy_len = 0;
+			}
+
+			// near end of buffer, copy byte by byte and keep the rest of match for next call
+			while (pos < end && m_is.good()) {
+				int symbol = m_is.read_code(m_lz->lencode);
+				if (symbol < 256) {
+					if (symbol < 0) {
+						throw std::system_error(make_error_code(DeflateError::invalid_huffman_code));
+					}
+					out[pos++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+				if (symbol == 256) {
+					m_state = State::block;
+					break;
+				}
+				read_match(symbol, pos);
+				pos = copy_pending(pos);
+			}
+			m_pos = pos;
+
+			if (!m_is.good()) {
+				throw std::system_error(make_error_code(DeflateError::general_error));
+			}
+		}
+
+		/// read length and distance of match into `m_copy_len` and `m_dist`
+		void read_match(int symbol, size_t pos) {
+			symbol -= 257;
+			if (symbol >= 29) {
+				throw std::system_error(make_error_code(DeflateError::invalid_huffman_code));
+			}
+			m_copy_len = lens[symbol] + m_is.read_bits(lext[symbol]);
+
+			symbol = m_is.read_code(m_lz->distcode);
+			if (symbol < 0) {
+				throw std::system_error(make_error_code(DeflateError::invalid_huffman_code));
+			}
+			m_dist = dists[symbol] + m_is.read_bits(dext[symbol]);
+
+			// buffer always hold whole window in front of `pos` after it slides
+			if (m_dist > pos || m_dist > m_window) {
+				throw std::system_error(make_error_code(DeflateError::distance_exceeded));
+			}
+		}
+
+		/// copy as much of pending match as buffer can hold
+		size_t copy_pending(size_t pos) {
+			size_t n = std::min(m_copy_len, m_cap - pos);
+			m_copy_len -= n;
+			while (n--) {
+				m_dst[pos] = m_dst[pos - m_dist];
+				++pos;
+			}
+			return pos;
+		}
+
+		InflateStream m_is;
+		State m_state = State::header;
+		bool m_final = false;
+		bool m_segment = false;
+		std::vector<uint8_t> m_buf; // window then decoded chunk, kept between images by adopt()
+		uint8_t* m_dst = nullptr; // decode target, `m_buf` or caller's buffer of read_all()
+		size_t m_cap = 0;
+		size_t m_window = 0;
+		size_t m_pos = 0; // end of decoded bytes
+		size_t m_out = 0; // begin of bytes that not yet read
+		size_t m_stored_left = 0;
+		size_t m_copy_len = 0; // pending match
+		size_t m_dist = 0;
+		const Lz77code* m_lz = nullptr;
+		Lz77code_ptr m_dynamic;
+	};
+}
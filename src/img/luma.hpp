@@ -0,0 +1,148 @@
+#pragma once
+
+#include "cpu.hpp"
+#include "pixel.hpp"
+#include "row_iterator.hpp"
+#include <cstring>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/// luminance plane, 8 bits per pixel, that is what character mapping and scaling need
+namespace img
+{
+#if defined(IMG_X86)
+	namespace kernel {
+		/// 4 pixels of 16 bits lanes multiplied by `w` then every pixel summed to one 32 bits lane
+		IMG_TARGET("ssse3") inline __m128i weighted_sum(__m128i px, __m128i w) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), w));
+			__m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(px, zero), w));
+			__m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+			return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(128)), 8);
+		}
+
+		/// luma of 4 pixels of `STRIDE` bytes, 3 bytes pixels are spread to 4 bytes first
+		template<size_t STRIDE>
+		IMG_TARGET("ssse3") inline __m128i luma4(const uint8_t* px, __m128i w) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(px));
+			if constexpr (STRIDE == 3) {
+				v = _mm_shuffle_epi8(v, _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+			}
+			return weighted_sum(v, w);
+		}
+
+		/// weights of 2 pixels in 16 bits lanes, `R`, `G` and `B` are byte offsets in pixel
+		template<size_t R, size_t G, size_t B>
+		IMG_TARGET("ssse3") inline __m128i luma_weights() {
+			alignas(16) int16_t w[8]{};
+			w[R] = w[R + 4] = LUMA_R;
+			w[G] = w[G + 4] = LUMA_G;
+			w[B] = w[B + 4] = LUMA_B;
+			return _mm_load_si128(reinterpret_cast<const __m128i*>(w));
+		}
+
+		/// 16 pixels per step
+		/// @return number of pixels done, rest is left for scalar loop
+		template<size_t STRIDE, size_t R, size_t G, size_t B>
+		IMG_TARGET("ssse3") size_t luma_ssse3(const uint8_t* px, size_t n, uint8_t* out) {
+			const __m128i w = luma_weights<R, G, B>();
+			// 3 bytes pixels load 4 bytes after last pixel of step
+			const size_t tail = STRIDE == 3 ? 2 : 0;
+			size_t i = 0;
+			for (; i + 16 + tail <= n; i += 16) {
+				const uint8_t* p = px + i * STRIDE;
+				__m128i a = _mm_packs_epi32(luma4<STRIDE>(p, w), luma4<STRIDE>(p + 4 * STRIDE, w));
+				__m128i b = _mm_packs_epi32(luma4<STRIDE>(p + 8 * STRIDE, w), luma4<STRIDE>(p + 12 * STRIDE, w));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+			}
+			return i;
+		}
+	}
+#endif
+
+	/// luma8() of `n` pixels of `STRIDE` bytes that `R`, `G` and `B` are byte offsets in,
+	/// e.g. high bytes of 16 bits samples
+	template<size_t STRIDE, size_t R, size_t G, size_t B>
+	void luma_bytes(const uint8_t* px, size_t n, uint8_t* out) {
+		size_t i = 0;
+#if defined(IMG_X86)
+		if constexpr ((STRIDE == 3 || STRIDE == 4) && R < 4 && G < 4 && B < 4) {
+			if (cpu::features().ssse3) {
+				i = kernel::luma_ssse3<STRIDE, R, G, B>(px, n, out);
+			}
+		}
+#endif
+		for (; i < n; ++i) {
+			const uint8_t* p = px + i * STRIDE;
+			out[i] = static_cast<uint8_t>((LUMA_R * p[R] + LUMA_G * p[G] + LUMA_B * p[B] + 128) >> 8);
+		}
+	}
+
+	/// @param out must hold `row.size()` bytes
+	template<typename PX>
+	void luma_row(std::span<const PX> row, uint8_t* out) {
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(row.data());
+		if constexpr (std::is_same_v<PX, uint8_t>) {
+			std::memcpy(out, p, row.size());
+		}
+		else if constexpr (std::is_same_v<PX, Rgb24>) {
+			static_assert(sizeof(Rgb24) == 3);
+			luma_bytes<3, 2, 1, 0>(p, row.size(), out);
+		}
+		else {
+			static_assert(std::is_same_v<PX, Rgba32>);
+			luma_bytes<4, 0, 1, 2>(p, row.size(), out);
+		}
+	}
+
+	/// rows of decoder as luminance plane, decoder that has next_luma() hand out luma
+	/// without going through pixels. returned row is valid until next row
+	template<typename DECODER>
+	struct Luma_rows {
+		using row_type = std::span<const uint8_t>;
+		using iterator = Row_iterator<Luma_rows>;
+
+		/// `decoder` must outlive rows
+		explicit Luma_rows(DECODER& decoder) :m_decoder{ decoder } {}
+
+		/// forward to decoder that can skip rows
+		void sample(std::span<const uint32_t> rows) requires requires(DECODER& d) { d.sample(std::span<const uint32_t>{}); } {
+			m_decoder.sample(rows);
+		}
+
+		/// @return next row, empty when every row is decoded
+		row_type next() {
+			if constexpr (requires { m_decoder.next_luma(); }) {
+				return m_decoder.next_luma();
+			}
+			else {
+				if (!m_it) {
+					m_it.emplace(m_decoder.begin());
+				}
+				else {
+					++*m_it;
+				}
+				if (*m_it == m_decoder.end()) {
+					return {};
+				}
+				auto row = **m_it;
+				m_luma.resize(row.size());
+				luma_row(row, m_luma.data());
+				return m_luma;
+			}
+		}
+
+		iterator begin() { return iterator{ this, next() }; }
+		iterator end() { return iterator{ this, {} }; }
+
+	private:
+		using decoder_iterator = decltype(std::declval<DECODER&>().begin());
+
+		DECODER& m_decoder;
+		std::optional<decoder_iterator> m_it;
+		std::vector<uint8_t> m_luma;
+	};
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "inflater.hpp"
+#include "thread_pool.hpp"
+#include <deque>
+#include <future>
+#include <optional>
+
+namespace img::deflate
+{
+	/// compressed bytes below this are not worth to be own segment
+	constexpr size_t MIN_SEGMENT = 1 << 18;
+
+	constexpr size_t NO_POINT = SIZE_MAX;
+
+	/// first position that is at least `min_pos` and right after `00 00 FF FF`, the empty stored
+	/// block that full flush emits, next block starts there. position at end of data isn't taken
+	/// since no block follow it (yet), so every split has data on both sides
+	/// @param data raw deflate data
+	/// @return NO_POINT when there is none
+	inline size_t next_flush_point(bytes_view data, size_t min_pos) {
+		// `k` is first 0xFF of candidate, point is `k + 2`
+		size_t i = std::max<size_t>(min_pos, 4) - 2;
+		while (i + 2 < data.size()) {
+			const void* hit = std::memchr(data.data() + i, 0xFF, data.size() - 2 - i);
+			if (!hit) {
+				break;
+			}
+			const size_t k = static_cast<const uint8_t*>(hit) - data.data();
+			if (data[k - 2] == 0 && data[k - 1] == 0 && data[k + 1] == 0xFF) {
+				return k + 2;
+			}
+			i = k + 1;
+		}
+		return NO_POINT;
+	}
+
+	/// read zlib stream through and look for flush point that Parallel_inflater would split at,
+	/// keeping only few bytes of it. tell whether it is worth to inflate stream in parallel
+	/// @param src zlib stream, it is consumed
+	bool has_flush_point(ByteSource& src, size_t min_gap = MIN_SEGMENT) {
+		std::vector<uint8_t> tail; // last bytes of deflate data then current view, marker may span views
+		uint64_t base = 0; // position of `tail` in deflate data
+		size_t header = 2;
+		for (bytes_view v; !(v = src.take(Inflater::CHUNK_SIZE)).empty(); ) {
+			const size_t h = std::min(header, v.size());
+			header -= h;
+			v = v.subspan(h);
+			// marker that end right at previous view is kept whole, it wasn't taken without data after it
+			if (tail.size() > 4) {
+				base += tail.size() - 4;
+				tail.erase(tail.begin(), tail.end() - 4);
+			}
+			tail.insert(tail.end(), v.begin(), v.end());
+			if (next_flush_point(tail, min_gap > base ? static_cast<size_t>(min_gap - base) : 0) != NO_POINT) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	struct Segment {
+		std::vector<uint8_t> data;
+		bool final_block = false;
+	};
+
+	/// inflate one segment into growing buffer
+	/// @param cap most bytes that segment may inflate to
+	/// @return nullopt when segment inflate to more than `cap`, e.g. it doesn't start at real flush point
+	std::optional<Segment> inflate_segment(bytes_view data, size_t cap) {
+		MemorySource src{ data };
+		Inflater inflater{ src, true };
+		Segment seg;
+		size_t size = 0;
+		do {
+			if (size > cap) {
+				return std::nullopt;
+			}
+			// one byte over cap is enough to tell
+			const size_t n = std::min(Inflater::CHUNK_SIZE, cap + 1 - size);
+			seg.data.resize(size + n);
+			size += inflater.read({ seg.data.data() + size, n });
+		} while (!inflater.done());
+		if (size > cap) {
+			return std::nullopt;
+		}
+		seg.data.resize(size);
+		seg.final_block = inflater.final_block();
+		return seg;
+	}
+
+	/// inflate zlib stream by segments between full flush points on pool while it is read in order.
+	/// stream is read ahead only until few segments are queued, so neither stream nor output is
+	/// kept whole. each segment has to end exactly at next point and must not refer to data before
+	/// it, that rejects `00 00 FF FF` that happen to be in compressed data and sync flush. from
+	/// first rejected segment on, rest of stream is inflated serially after output so far
+	struct Parallel_inflater {
+		/// most bytes that one segment may inflate to, compressed data that grow over it
+		/// without flush point is inflated serially
+		static constexpr size_t SEGMENT_LIMIT = 1 << 23;
+
+		/// @param src zlib stream
+		/// @param in_flight segments that are queued at once, 0 = one more than threads of pool
+		Parallel_inflater(ByteSource& src, ThreadPool& pool, size_t in_flight = 0, size_t min_segment = MIN_SEGMENT) :
+			m_src{ src },
+			m_pool{ pool },
+			m_in_flight{ in_flight ? in_flight : pool.size() + 1 },
+			m_min_segment{ min_segment },
+			m_rest{ src }
+		{
+		}
+
+		Parallel_inflater(const Parallel_inflater&) = delete;
+		Parallel_inflater& operator=(const Parallel_inflater&) = delete;
+
+		~Parallel_inflater() {
+			wait();
+		}
+
+		/// @return number of bytes written, less than `out.size()` only when stream is ended
+		size_t read(std::span<uint8_t> out) {
+			size_t done = 0;
+			while (done < out.size()) {
+				if (m_serial) {
+					done += m_serial->read(out.subspan(done));
+					break;
+				}
+				if (m_out == m_seg.size()) {
+					if (!next_segment()) {
+						break;
+					}
+					continue;
+				}
+				const size_t n = std::min(out.size() - done, m_seg.size() - m_out);
+				std::memcpy(out.data() + done, m_seg.data() + m_out, n);
+				m_out += n;
+				done += n;
+			}
+			return done;
+		}
+
+	private:
+		struct Job {
+			std::vector<uint8_t> data; // compressed, task reads it in place
+			std::future<std::optional<Segment>> result; // not valid for data that isn't split
+		};
+
+		/// compressed data that is left when inflate goes serial, then rest of stream
+		struct Rest_source : ByteSource {
+			explicit Rest_source(ByteSource& src) :m_src{ src } {}
+
+			bytes_view take(size_t n) override {
+				while (!m_parts.empty()) {
+					auto& part = m_parts.front();
+					if (m_at < part.size()) {
+						bytes_view v = bytes_view{ part }.subspan(m_at, std::min(n, part.size() - m_at));
+						m_at += v.size();
+						return v;
+					}
+					m_parts.pop_front();
+					m_at = 0;
+				}
+				return m_src.take(n);
+			}
+
+			bool seek(uint64_t) override {
+				return false;
+			}
+
+			uint64_t tell() const override {
+				return 0;
+			}
+
+			std::deque<std::vector<uint8_t>> m_parts;
+			size_t m_at = 0;
+			ByteSource& m_src;
+		};
+
+		/// hand out output of front segment, or go serial when it is rejected
+		/// @return false when stream is ended
+		bool next_segment() {
+			keep_history();
+			if (m_final) {
+				return false;
+			}
+			fill();
+			if (m_jobs.empty()) {
+				return false;
+			}
+			std::optional<Segment> seg;
+			if (m_jobs.front().result.valid()) {
+				try {
+					seg = m_jobs.front().result.get();
+				}
+				catch (const std::system_error&) {
+				}
+			}
+			if (!seg) {
+				go_serial();
+				return true;
+			}
+			m_jobs.pop_front();
+			m_seg = std::move(seg->data);
+			m_out = 0;
+			m_final = seg->final_block;
+			return true;
+		}
+
+		/// last window of output before next segment, serial inflate may refer to it
+		void keep_history() {
+			const size_t window = deflate_window_size(7);
+			if (m_seg.size() >= window) {
+				m_history.assign(m_seg.end() - window, m_seg.end());
+			}
+			else {
+				m_history.insert(m_history.end(), m_seg.begin(), m_seg.end());
+				if (m_history.size() > window) {
+					m_history.erase(m_history.begin(), m_history.end() - window);
+				}
+			}
+			m_seg.clear();
+			m_out = 0;
+		}
+
+		/// read stream until enough segments are queued, or it is ended
+		void fill() {
+			while (m_jobs.size() < m_in_flight && !m_src_done) {
+				const size_t scanned = m_pending.size();
+				bytes_view v = m_src.take(Inflater::CHUNK_SIZE);
+				if (v.empty()) {
+					m_src_done = true;
+					if (!m_pending.empty()) {
+						submit(m_pending.size());
+					}
+					break;
+				}
+				if (m_header < 2) {
+					const size_t h = std::min<size_t>(2 - m_header, v.size());
+					std::memcpy(m_head + m_header, v.data(), h);
+					m_header += h;
+					v = v.subspan(h);
+					if (m_header == 2) {
+						Header header;
+						std::memcpy(&header.data, m_head, 2);
+						if (header.CF != 8 || header.CINFO > 7 || header.FDICT != 0) {
+							throw std::system_error(make_error_code(DeflateError::general_error));
+						}
+					}
+				}
+				m_pending.insert(m_pending.end(), v.begin(), v.end());
+				// marker that ended right at previous view is looked at again now that data follow it
+				for (size_t p = next_flush_point(m_pending, std::max(m_min_segment, scanned)); p != NO_POINT;
+					p = next_flush_point(m_pending, m_min_segment)) {
+					submit(p);
+				}
+				if (m_pending.size() > SEGMENT_LIMIT) {
+					// no point soon enough, rest is inflated serially once it is reached
+					m_jobs.push_back({ std::move(m_pending), {} });
+					m_pending.clear();
+					m_src_done = true;
+				}
+			}
+		}
+
+		/// queue first `n` bytes of pending data as segment
+		void submit(size_t n) {
+			Job& job = m_jobs.emplace_back();
+			job.data = std::move(m_pending);
+			m_pending.assign(job.data.begin() + n, job.data.end());
+			job.data.resize(n);
+			bytes_view seg = job.data;
+			job.result = m_pool.submit([seg] { return inflate_segment(seg, SEGMENT_LIMIT); });
+		}
+
+		/// inflate every queued data then rest of stream after output so far
+		void go_serial() {
+			wait();
+			for (auto& job : m_jobs) {
+				m_rest.m_parts.push_back(std::move(job.data));
+			}
+			m_jobs.clear();
+			m_rest.m_parts.push_back(std::move(m_pending));
+			m_serial.emplace(m_rest, m_history);
+		}
+
+		/// every task reads data of its job, each one is waited for before job is dropped
+		void wait() {
+			for (auto& job : m_jobs) {
+				if (job.result.valid()) {
+					job.result.wait();
+				}
+			}
+		}
+
+		ByteSource& m_src;
+		ThreadPool& m_pool;
+		const size_t m_in_flight;
+		const size_t m_min_segment;
+		uint8_t m_head[2]{};
+		size_t m_header = 0; // bytes of zlib header that are read
+		bool m_src_done = false; // no more data is split off
+		std::vector<uint8_t> m_pending; // data after last split
+		std::deque<Job> m_jobs;
+		std::vector<uint8_t> m_seg; // output of segment that is handed out
+		size_t m_out = 0;
+		bool m_final = false;
+		std::vector<uint8_t> m_history; // last window of output before `m_seg`
+		Rest_source m_rest;
+		std::optional<Inflater> m_serial;
+	};
+}
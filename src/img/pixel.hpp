@@ -37,6 +37,17 @@ namespace img {
 		return 0.2126 * c.r + 0.7152 * c.g + 0.0722 * c.b;
 	}
 
+	/// weights of luminance() in 8 bits fixed point, sum is 256
+	constexpr int LUMA_R = 54;
+	constexpr int LUMA_G = 183;
+	constexpr int LUMA_B = 19;
+
+	/// luminance() rounded to 0..255 without floating point
+	template<typename T>
+	uint8_t luma8(T c) {
+		return static_cast<uint8_t>((LUMA_R * c.r + LUMA_G * c.g + LUMA_B * c.b + 128) >> 8);
+	}
+
 	/*Rgba32 operator+(Rgba32 a, Rgba32 b) {
 		Rgba32 ret;
 		ret.r = a.r + b.r;
@@ -1,74 +1,35 @@
 #pragma once
 
-#include "deflate_generator.hpp"
+#include "crc32.hpp"
+#include "inflater.hpp"
+#include "parallel_inflate.hpp"
+#include "png_convert.hpp"
 #include "png_error.hpp"
+#include "png_filter.hpp"
 #include "pixel.hpp"
+#include "row_iterator.hpp"
+#include "source.hpp"
 #include <iostream>
-#include <fstream>
 #include <optional>
+#include <span>
 
 
 /// https://www.w3.org/TR/png/#13Decompression
 namespace img::png {
 
-	/// @brief for changing endian purpose
-	template<typename T, size_t SIZE = sizeof(T), size_t MAX_IDX = SIZE - 1>
-		requires std::integral<T>
-	void read_reverse(std::istream& is, T& buf) {
-		for (int i = 0; i < SIZE; ++i) {
-			is.read(&reinterpret_cast<char*>(&buf)[MAX_IDX - i], 1);
-		}
-	}
-
 	constexpr uint64_t PNG_SIGNATURE = 0x8950'4E47'0D0A'1A0A;
 
+	/// width and height are at most 2^31-1
+	constexpr uint32_t MAX_DIMENSION = 0x7FFF'FFFF;
+
 	enum struct ChunkId :uint32_t {
 		IHDR = 0x4948'4452,
+		PLTE = 0x504C'5445,
+		tRNS = 0x7452'4E53,
 		IDAT = 0X4944'4154,
 		IEND = 0x4945'4E44
 	};
 
-	enum struct BitDepth :uint8_t {
-		bit1 = 1,
-		bit2 = 2,
-		bit4 = 4,
-		bit8 = 8,
-		bit16 = 16,
-	};
-	enum struct ColorType :uint8_t {
-		indexed = 0,
-		grayscale = 2,
-		grayscale_a = 3,
-		truecolor = 4,
-		truecolor_a = 6,
-	};
-
-	enum struct FilterType :uint8_t {
-		None = 0,
-		Sub ,
-		Up ,
-		Average ,
-		Paeth,
-	};
-
-	int num_channel(ColorType c) {
-		switch (c)
-		{
-		case ColorType::indexed:
-			return 1;
-		case ColorType::grayscale:
-			return 1;
-		case ColorType::grayscale_a:
-			return 2;
-		case ColorType::truecolor:
-			return 3;
-		case ColorType::truecolor_a:
-			return 4;
-		default:
-			return 0;
-		}
-	}
-
 	struct IHDR {
 		uint32_t width;
 		uint32_t height;
@@ -76,296 +37,647 @@ namespace img::png {
 		ColorType color_type;
 		uint8_t compress_method;
 		uint8_t filter_method;
-		bool interlace;
+		uint8_t interlace;
 	};
 
 	struct Png {
 		
 		size_t row_size() const{
-			return num_channel(ihdr.color_type) * static_cast<int>(ihdr.bitdetph) * ihdr.width / 8;
+			return row_size(ihdr.width);
+		}
+
+		/// bytes of row that is `width` pixels, e.g. row of interlace pass
+		size_t row_size(uint32_t width) const {
+			return (num_channel(ihdr.color_type) * static_cast<size_t>(ihdr.bitdetph) * width + 7) / 8;
+		}
+
+		/// size of inflated IDAT data of non-interlaced image, every row has filter type in front
+		size_t raw_size() const {
+			return (row_size() + 1) * ihdr.height;
+		}
+
+		/// bytes per complete pixel that used by filter, at least 1
+		size_t bpp() const {
+			return std::max(1, num_channel(ihdr.color_type) * static_cast<int>(ihdr.bitdetph) / 8);
 		}
 
 		IHDR ihdr;
+		Color_table colors;
+		uint32_t idat_length = 0; // length of first IDAT
+		/// check CRC of IHDR, PLTE, tRNS and IDAT, set before read_meta()
+		bool verify_crc = false;
 	};
 
-	std::istream& operator>>(std::istream& is, IHDR& ihdr) {
-		read_reverse(is, ihdr.width);
-		read_reverse(is, ihdr.height);
-	
-		return is
-			.read(reinterpret_cast<char*>(&ihdr.bitdetph), 1)
-			.read(reinterpret_cast<char*>(&ihdr.color_type), 1)
-			.read(reinterpret_cast<char*>(&ihdr.compress_method), 1)
-			.read(reinterpret_cast<char*>(&ihdr.filter_method), 1)
-			.read(reinterpret_cast<char*>(&ihdr.interlace), 1);
+	/// CRC of chunk type, chunk CRC continue from it with chunk data
+	inline uint32_t chunk_crc(uint32_t id) {
+		const uint8_t type[4] = { static_cast<uint8_t>(id >> 24), static_cast<uint8_t>(id >> 16), static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id) };
+		return crc32(0, type);
 	}
 
+	/// chunk data that is parsed field by field, CRC is computed as bytes are taken
+	struct CrcSource : ByteSource {
+		CrcSource(ByteSource& src, uint32_t id) :m_src{ src }, crc{ chunk_crc(id) } {}
+
+		bytes_view take(size_t n) override {
+			bytes_view v = m_src.take(n);
+			crc = crc32(crc, v);
+			return v;
+		}
+
+		/// not seekable, every byte must go through crc
+		bool seek(uint64_t) override {
+			return false;
+		}
+
+		uint64_t tell() const override {
+			return m_src.tell();
+		}
+
+		/// take rest of chunk data then compare with CRC that follows it
+		/// @param left bytes of data that are not taken yet
+		bool verify(uint32_t left) {
+			while (left) {
+				bytes_view v = take(left);
+				if (v.empty()) {
+					return false;
+				}
+				left -= static_cast<uint32_t>(v.size());
+			}
+			uint32_t stored = 0;
+			return read_be(m_src, stored) && stored == crc;
+		}
+
+	private:
+		ByteSource& m_src;
+		uint32_t crc;
+	};
 
+	/// @return false when chunk data is too short
+	bool read_ihdr(ByteSource& src, IHDR& ihdr) {
+		return read_be(src, ihdr.width)
+			&& read_be(src, ihdr.height)
+			&& read_be(src, ihdr.bitdetph)
+			&& read_be(src, ihdr.color_type)
+			&& read_be(src, ihdr.compress_method)
+			&& read_be(src, ihdr.filter_method)
+			&& read_be(src, ihdr.interlace);
+	}
 
-	bool goto_chunk(std::istream& is, ChunkId id) {
+	/// skip chunks until chunk `id`, source points to its data after return
+	/// @param length length of chunk data when found
+	bool goto_chunk(ByteSource& src, ChunkId id, uint32_t* length = nullptr) {
 		uint32_t last_size = 0;
 		uint32_t last_id = 0;
-		while (is.good()) {
-			read_reverse(is, last_size);
-			read_reverse(is, last_id);
+		while (read_be(src, last_size) && read_be(src, last_id)) {
 			if (last_id == static_cast<uint32_t>(id)) {
+				if (length) {
+					*length = last_size;
+				}
 				return true;
 			}
 			if (last_id == static_cast<uint32_t>(ChunkId::IEND)) {
 				return false;
 			}
-			is.seekg(last_size + 4, std::ios::cur);//skip crc and point to next chunk
+			if (!src.skip(last_size + 4ull)) {//skip crc and point to next chunk
+				return false;
+			}
 		}
 		return false;
 	}
 
-	std::error_code read_meta(std::istream& is, Png& png)
+	/// read PLTE and tRNS, other chunks before first IDAT are skipped.
+	/// source points to data of first IDAT after return
+	std::error_code read_colors(ByteSource& src, Png& png)
+	{
+		uint32_t length = 0;
+		uint32_t id = 0;
+		while (read_be(src, length) && read_be(src, id)) {
+			const bool verify = png.verify_crc && (static_cast<ChunkId>(id) == ChunkId::PLTE || static_cast<ChunkId>(id) == ChunkId::tRNS);
+			CrcSource body{ src, id };
+			ByteSource& in = verify ? static_cast<ByteSource&>(body) : src;
+			switch (static_cast<ChunkId>(id))
+			{
+			case ChunkId::IDAT:
+				png.idat_length = length;
+				return {};
+			case ChunkId::IEND:
+				return PngError::idat_not_found;
+			case ChunkId::PLTE:
+				if (length % 3 != 0 || length / 3 > 256) {
+					return PngError::invalid_palette;
+				}
+				png.colors.palette_size = length / 3;
+				for (uint32_t i = 0; i < png.colors.palette_size; ++i) {
+					Rgba32& c = png.colors.palette[i];
+					if (!read_be(in, c.r) || !read_be(in, c.g) || !read_be(in, c.b)) {
+						return PngError::invalid_palette;
+					}
+				}
+				png.colors.update_luma();
+				length = 0;
+				break;
+			case ChunkId::tRNS:
+				if (png.ihdr.color_type == ColorType::indexed) {
+					// alpha of first entries, rest stay opaque
+					for (uint32_t i = 0; i < length && i < 256; ++i) {
+						if (!read_be(in, png.colors.palette[i].a)) {
+							return PngError::invalid_palette;
+						}
+					}
+					length -= std::min(length, 256u);
+				}
+				else if (png.ihdr.color_type == ColorType::grayscale || png.ihdr.color_type == ColorType::truecolor) {
+					const uint32_t n = png.ihdr.color_type == ColorType::grayscale ? 1 : 3;
+					if (length != n * 2) {
+						return PngError::invalid_palette;
+					}
+					for (uint32_t i = 0; i < n; ++i) {
+						if (!read_be(in, png.colors.key[i])) {
+							return PngError::invalid_palette;
+						}
+					}
+					png.colors.has_key = true;
+					length = 0;
+				}
+				break;
+			default:
+				break;
+			}
+			if (verify) {
+				if (!body.verify(length)) {
+					return PngError::crc_mismatch;
+				}
+			}
+			else if (!src.skip(length + 4ull)) {//skip rest of data and crc
+				return PngError::idat_not_found;
+			}
+		}
+		return PngError::idat_not_found;
+	}
+
+	std::error_code read_meta(ByteSource& src, Png& png)
 	{
 		uint64_t signature{};
-		read_reverse(is, signature);
+		if (!read_be(src, signature) || signature != PNG_SIGNATURE) {
+			return PngError::invalid_signature;
+		}
 
-		std::error_code ec;
-		if (signature != PNG_SIGNATURE) {
-			ec = PngError::invalid_signature;
-			goto fail_return;
+		uint32_t length = 0;
+		if (!goto_chunk(src, ChunkId::IHDR, &length) || length != 13) {
+			return PngError::invalid_ihdr;
+		}
+		if (png.verify_crc) {
+			CrcSource body{ src, static_cast<uint32_t>(ChunkId::IHDR) };
+			if (!read_ihdr(body, png.ihdr)) {
+				return PngError::invalid_ihdr;
+			}
+			if (!body.verify(0)) {
+				return PngError::crc_mismatch;
+			}
+		}
+		else if (!read_ihdr(src, png.ihdr) || !src.skip(4)) {//skip crc and point to next chunk
+			return PngError::invalid_ihdr;
 		}
+		if (png.ihdr.width == 0 || png.ihdr.height == 0 || png.ihdr.width > MAX_DIMENSION || png.ihdr.height > MAX_DIMENSION) {
+			return PngError::invalid_ihdr;
+		}
+
+		return read_colors(src, png);
+	}
 
-		if (!goto_chunk(is, ChunkId::IHDR)) {
-			ec = PngError::invalid_ihdr;
-			goto fail_return;
+	/// data of consecutive IDAT chunks as one stream, crc, length and type between them are skipped.
+	/// when source can hand out end of data and next chunk head in one view they are taken together
+	struct IdatSource : ByteSource {
+		/// crc of current chunk then length and type of next chunk
+		static constexpr size_t TRAILER_SIZE = 12;
+
+		explicit IdatSource(ByteSource& src) :m_src{ src } {}
+
+		/// source must be at data of first IDAT, as read_meta() leaves it
+		/// @param length length of first IDAT
+		/// @param verify check CRC of each IDAT as its data is taken, mismatch throw crc_mismatch
+		void open(uint32_t length, bool verify = false) {
+			m_left = length;
+			m_done = false;
+			m_verify = verify;
+			m_crc = chunk_crc(static_cast<uint32_t>(ChunkId::IDAT));
 		}
 
-		is >> png.ihdr; //chunk data
+		bytes_view take(size_t n) override {
+			while (m_left == 0) {
+				if (m_done || !read_trailer()) {
+					return {};
+				}
+			}
+			const bool to_end = n >= m_left;
+			bytes_view v = m_src.take(to_end ? m_left + TRAILER_SIZE : n);
+			if (v.empty()) {
+				m_done = true; // truncated file
+				return {};
+			}
+			if (v.size() <= m_left) {
+				m_left -= v.size();
+				m_pos += v.size();
+				if (m_verify) {
+					m_crc = crc32(m_crc, v);
+				}
+				return v;
+			}
+			// read ahead, keep trailer that came with end of data
+			m_trailer_len = v.size() - m_left;
+			std::memcpy(m_trailer, v.data() + m_left, m_trailer_len);
+			v = v.first(m_left);
+			m_left = 0;
+			m_pos += v.size();
+			if (m_verify) {
+				m_crc = crc32(m_crc, v);
+			}
+			if (m_trailer_len == TRAILER_SIZE) {
+				parse_trailer();
+			}
+			return v;
+		}
 
-		is.seekg(4, std::ios::cur);//skip crc and point to next chunk
+		/// take data that inflater never pulled, usually Adler-32 at end of zlib stream,
+		/// so trailer of every chunk is parsed and with verify, CRC of every chunk is checked
+		void drain() {
+			while (!take(deflate::Inflater::CHUNK_SIZE).empty()) {
+			}
+		}
 
-		return ec;
+		/// not seekable
+		bool seek(uint64_t) override {
+			return false;
+		}
 
-	fail_return:
-		is.setstate(std::ios::badbit);
-		return ec;
-	}
+		/// position in concatenated data
+		uint64_t tell() const override {
+			return m_pos;
+		}
 
-	using bytes_t = std::vector<uint8_t>;
+	private:
+		/// @return false when source is ended
+		bool read_trailer() {
+			m_trailer_len += m_src.read(m_trailer + m_trailer_len, TRAILER_SIZE - m_trailer_len);
+			if (m_trailer_len < TRAILER_SIZE) {
+				m_done = true;
+				return false;
+			}
+			parse_trailer();
+			return true;
+		}
 
-	struct Rgba32_view {
-		using container_t = bytes_t;
-		using value_t = Rgba32;
-
-		struct iterator{
-			using view_type = Rgba32_view;
-			using iterator_category = std::input_iterator_tag;
-			using value_type = value_t;
-			using difference_type = std::ptrdiff_t;
-			using pointer = size_t;
-			using reference = value_type;
-			using self_type = iterator;
-			iterator(pointer _ptr, view_type& _view) :ptr{ _ptr }, view{_view} {}
-
-			self_type& operator++()
-			{
-				++ptr;
-				return *this;
+		/// @throw crc_mismatch when CRC of chunk that just ended is wrong
+		void parse_trailer() {
+			uint32_t stored = 0;
+			uint32_t length = 0;
+			uint32_t id = 0;
+			for (size_t i = 0; i < 4; ++i) {
+				stored = (stored << 8) | m_trailer[i];
+				length = (length << 8) | m_trailer[i + 4];
+				id = (id << 8) | m_trailer[i + 8];
 			}
-			self_type operator++(int)
-			{
-				self_type retval = *this;
-				++(*this);
-				return retval;
-			}
-			bool operator==(self_type other) const { return ptr == other.ptr; }
-			bool operator!=(self_type other) const { return !(*this == other); }
-			reference operator*() const { return view[ptr]; }
-		private:
-			pointer ptr;
-			view_type& view;
-		};
-	
-		Rgba32_view(container_t& c) :data{c} {}
-	
-		value_t operator[](size_t i) {
-			auto pos = i * 4;
-			return value_t{data[pos], data[pos + 1] , data[pos + 2] , data[pos + 3]};
-		}
-
-		size_t size() const {
-			return data.size() / 4;
-		}
-		iterator begin() { return iterator{ 0, *this }; }
-		iterator end() { return iterator{ size(), *this }; }
-	private:
-		container_t& data;
-	};
+			m_trailer_len = 0;
+			if (m_verify) {
+				if (stored != m_crc) {
+					throw std::system_error(make_error_code(PngError::crc_mismatch));
+				}
+				m_crc = chunk_crc(static_cast<uint32_t>(ChunkId::IDAT));
+			}
+			if (id == static_cast<uint32_t>(ChunkId::IDAT)) {
+				m_left = length;
+			}
+			else {
+				m_done = true;
+			}
+		}
 
-	int paeth(int a, int b, int c) {
-		int p = a + b - c;
-		int pa = std::abs(p - a);
-		int pb = std::abs(p - b);
-		int pc = std::abs(p - c);
+		ByteSource& m_src;
+		uint64_t m_pos = 0;
+		uint32_t m_left = 0; // data left in current chunk
+		bool m_done = true;
+		uint8_t m_trailer[TRAILER_SIZE]{};
+		size_t m_trailer_len = 0;
+		bool m_verify = false;
+		uint32_t m_crc = 0; // of current chunk so far
+	};
 
-		if (pa <= pb && pa <= pc) {
-			return a;
+	/// read IDAT through for full flush point then go back to data of first IDAT, so stream
+	/// that can't be inflated in parallel anyway (most encoders never flush) isn't read ahead.
+	/// source that can't go back is never scanned
+	/// @return true when parallel inflate is worth to try
+	inline bool idat_has_flush_point(ByteSource& src, const Png& png) {
+		if (!src.seekable()) {
+			return false;
 		}
-		if (pb <= pc) {
-			return b;
+		const uint64_t start = src.tell();
+		IdatSource idat{ src };
+		idat.open(png.idat_length);
+		const bool found = deflate::has_flush_point(idat);
+		if (!src.seek(start)) {
+			throw std::system_error(make_error_code(PngError::invalid_idat));
 		}
-		return c;
+		return found;
 	}
-	
-	template<typename V = Rgba32_view>
-	struct Row_decoder {
-		using row_type = bytes_t;
-		using view_type = V;
-		
 
-		Row_decoder(std::istream& is, const Png& png) :m_is{ is }, m_png{ png }, row_excl_filt_size{ png.row_size() } {
-		
+	using bytes_t = std::vector<uint8_t>;
+
+	/// images that raw (filtered) data is not over this size are inflated in one go by default
+	constexpr size_t WHOLE_DECODE_LIMIT = 1 << 26;
+
+	static_assert(sizeof(Rgba32) == 4, "Rgba32 must be same layout as RGBA 8 bits per sample");
+
+	/// allocations of decoder that caller can keep to reuse them for next image
+	struct Decode_scratch {
+		bytes_t rows;
+		bytes_t raw;
+		deflate::Inflater::Buffers inflate;
+	};
+
+	/// decode rows of IDAT one by one, returned row points into decoder's own buffer
+	/// and is valid until next row is decoded
+	struct Row_decoder {
+		using pixel_type = Rgba32;
+		using row_type = std::span<const pixel_type>;
+
+		using iterator = Row_iterator<Row_decoder>;
+
+		/// @param whole inflate all IDAT data into one buffer before unfilter instead of row by row
+		/// @param pool inflate segments between full flush points in parallel
+		/// @param scratch buffers are taken from it and given back when decoder is destroyed
+		Row_decoder(ByteSource& src, const Png& png, bool whole = false, ThreadPool* pool = nullptr, Decode_scratch* scratch = nullptr) :
+			m_src{ src },
+			m_png{ png },
+			m_idat{ src },
+			m_inflater{ m_idat },
+			row_excl_filt_size{ png.row_size() },
+			unfilter{ png.bpp() },
+			convert{ select_converter(png.ihdr.color_type, png.ihdr.bitdetph) },
+			to_luma{ select_luma(png.ihdr.color_type, png.ihdr.bitdetph) },
+			m_whole{ whole },
+			m_pool{ pool },
+			m_scratch{ scratch }
+		{
+			if (m_scratch) {
+				m_inflater.adopt(std::move(m_scratch->inflate));
+				m_rows = std::move(m_scratch->rows);
+				m_raw = std::move(m_scratch->raw);
+			}
 		}
 
-		Generator<view_type*> operator()() {
-			if (!goto_chunk(m_is, ChunkId::IDAT)) {
-				throw std::system_error(make_error_code(PngError::idat_not_found));
+		~Row_decoder() {
+			if (m_scratch) {
+				m_scratch->inflate = m_inflater.release();
+				m_scratch->rows = std::move(m_rows);
+				m_scratch->raw = std::move(m_raw);
 			}
+		}
 
-			deflate::Inflater_generator decomp{ m_is };
-		
-			auto gen = decomp();
-
-			cur_row.reserve(row_excl_filt_size);
-			prev_row.reserve(row_excl_filt_size);
-
-			while (gen) {
-				auto type = static_cast<FilterType>(gen());
-				++acc_size;
-
-				cur_row.clear();
-				switch (type)
-				{
-				case FilterType::None:
-					acc_size += filter_none(gen);
-					break;
-				case FilterType::Sub:
-					acc_size += filter_sub(gen);
-					break;
-				case FilterType::Up:
-					acc_size += filter_up(gen);
-					break;
-				case FilterType::Average:
-					acc_size += filter_avg(gen);
-					break;
-				case FilterType::Paeth:
-					acc_size += filter_paeth(gen);
-					break;
-				default:
-					throw std::system_error(make_error_code(PngError::invalid_idat));
+		/// rows of sampled mode are inflated in windows of about this size
+		static constexpr size_t SAMPLE_WINDOW = 1 << 18;
+
+		/// hand out only `rows` (ascending), must be called before first row. other rows are
+		/// inflated but unfiltered only when a later row that is handed out refers to them
+		void sample(std::span<const uint32_t> rows) {
+			m_wanted.assign(m_png.ihdr.height, false);
+			for (uint32_t y : rows) {
+				if (y < m_png.ihdr.height) {
+					m_wanted[y] = true;
 				}
-				result.emplace(cur_row);
-				co_yield &(*result);
-				std::swap(cur_row, prev_row);
 			}
-			co_return;
 		}
 
-	private:
-		size_t filter_none(Generator<uint8_t>& gen) {
-			for (size_t i = 0;i < row_excl_filt_size; i++) { //no Generator validation must improve
-				cur_row.push_back(gen());
-			}
-			return row_excl_filt_size;
+		/// @return next row, empty when every row is decoded
+		row_type next() {
+			const uint8_t* row = next_unfiltered();
+			return row ? pixels(row) : row_type{};
 		}
 
-		size_t filter_sub(Generator<uint8_t>& gen) {
-			
-			for (size_t i = 0; i < row_excl_filt_size; i++) {
-				cur_row.push_back(gen() + recon_a(i));
+		/// next row as luma8() of its pixels, computed right from unfiltered bytes.
+		/// 8 bits grayscale is handed out as is
+		/// @return empty when every row is decoded
+		std::span<const uint8_t> next_luma() {
+			const uint8_t* row = next_unfiltered();
+			if (!row) {
+				return {};
+			}
+			if (!to_luma) {
+				return { row, m_png.ihdr.width };
 			}
-			return row_excl_filt_size;
+			m_luma.resize(m_png.ihdr.width);
+			to_luma(row, m_luma.data(), m_png.ihdr.width, m_png.colors);
+			return m_luma;
 		}
 
-		size_t filter_up(Generator<uint8_t>& gen) {
-		
-			for (size_t i = 0; i < row_excl_filt_size; i++) {
-				cur_row.push_back(gen() + recon_b(i));
+		iterator begin() { return iterator{ this, next() }; }
+		iterator end() { return iterator{ this, {} }; }
+
+	private:
+		/// @return next handed out row, nullptr when every row is decoded
+		const uint8_t* next_unfiltered() {
+			if (!m_prev) {
+				start();
+			}
+			if (!m_wanted.empty()) {
+				return next_sampled();
+			}
+			if (m_y == m_png.ihdr.height) {
+				return end_of_rows();
 			}
-			return row_excl_filt_size;
-		}
 
-		size_t filter_avg(Generator<uint8_t>& gen) {
-			for (size_t i = 0; i < row_excl_filt_size; i++) {
-				cur_row.push_back(gen() + ((recon_a(i) + recon_b(i)) /2));
+			uint8_t* line;
+			if (m_whole) {
+				line = m_raw.data() + m_y * (row_excl_filt_size + 1);
+			}
+			else {
+				line = m_prev == m_rows.data() + 1 ? m_rows.data() + row_excl_filt_size + 1 : m_rows.data();
+				if (inflate({ line, row_excl_filt_size + 1 }) != row_excl_filt_size + 1) {
+					throw std::system_error(make_error_code(PngError::invalid_idat));
+				}
 			}
 
-			return row_excl_filt_size;
+			uint8_t* cur = line + 1;
+			if (!unfilter(static_cast<FilterType>(line[0]), cur, m_prev, row_excl_filt_size)) {
+				throw std::system_error(make_error_code(PngError::invalid_idat));
+			}
+			m_prev = cur;
+			++m_y;
+			return cur;
 		}
 
-		size_t filter_paeth(Generator<uint8_t>& gen) {
-			for (size_t i = 0; i < row_excl_filt_size; i++) {
-				cur_row.push_back(gen() + paeth(recon_a(i), recon_b(i), recon_c(i)));
+		/// unfiltered row as pixels, 8 bits RGBA is handed out as is
+		row_type pixels(const uint8_t* row) {
+			if (!convert) {
+				return { reinterpret_cast<const pixel_type*>(row), m_png.ihdr.width };
 			}
+			m_pixels.resize(m_png.ihdr.width);
+			convert(row, m_pixels.data(), m_png.ihdr.width, m_png.colors);
+			return m_pixels;
+		}
 
-			return row_excl_filt_size;
+		/// whole mode has one window of every row
+		const uint8_t* next_sampled() {
+			const size_t line_size = row_excl_filt_size + 1;
+			while (m_y < m_png.ihdr.height) {
+				if (m_y == m_win_end) {
+					load_window();
+				}
+				const uint32_t i = m_y - m_win_begin;
+				uint8_t* line = m_win + i * line_size;
+				++m_y;
+				if (!m_need[i]) {
+					continue;
+				}
+				uint8_t* cur = line + 1;
+				unfilter(static_cast<FilterType>(line[0]), cur, m_prev, row_excl_filt_size);
+				m_prev = cur;
+				if (m_wanted[m_y - 1]) {
+					return cur;
+				}
+			}
+			return end_of_rows();
 		}
 
-		int recon_a(size_t i) {
-			if (i == 0) {
-				return 0;
+		/// with CRC check, rest of IDAT is read once every row is decoded
+		/// @return nullptr
+		const uint8_t* end_of_rows() {
+			if (m_png.verify_crc) {
+				m_idat.drain();
 			}
-			return cur_row[i - 1];
+			return nullptr;
 		}
-		int recon_b(size_t i) {
-			if (prev_row.size() == 0) {
-				return 0;
+
+		/// inflate next window of rows then mark rows that must be unfiltered, from last row back:
+		/// row is needed when it is wanted or next row is needed and filtered against it
+		void load_window() {
+			const size_t line_size = row_excl_filt_size + 1;
+			m_win_begin = m_y;
+			if (m_whole) {
+				m_win = m_raw.data();
+				m_win_end = m_png.ihdr.height;
+			}
+			else {
+				const uint32_t n = std::min(m_png.ihdr.height - m_y, static_cast<uint32_t>(std::max<size_t>(SAMPLE_WINDOW / line_size, 2)));
+				// window is inflated over last row of previous one, which is always unfiltered
+				if (m_y != 0) {
+					std::memmove(m_rows.data(), m_prev, row_excl_filt_size);
+				}
+				m_rows.resize(line_size * (n + 1));
+				m_prev = m_rows.data();
+				m_win = m_rows.data() + line_size;
+				m_win_end = m_y + n;
+				if (inflate({ m_win, line_size * n }) != line_size * n) {
+					throw std::system_error(make_error_code(PngError::invalid_idat));
+				}
+			}
+
+			const uint32_t n = m_win_end - m_win_begin;
+			m_need.resize(n);
+			// filter of row after window isn't known yet so last row is kept as if it were needed
+			bool next_needs = m_win_end != m_png.ihdr.height;
+			for (uint32_t i = n; i-- > 0; ) {
+				const uint8_t filter = m_win[i * line_size];
+				if (filter > static_cast<uint8_t>(FilterType::Paeth)) {
+					throw std::system_error(make_error_code(PngError::invalid_idat));
+				}
+				m_need[i] = next_needs || m_wanted[m_win_begin + i];
+				next_needs = m_need[i] && filter >= static_cast<uint8_t>(FilterType::Up);
 			}
-			return prev_row[i];
 		}
-		int recon_c(size_t i) {
-			if (i == 0) {
-				return 0;
+
+		void start() {
+			m_idat.open(m_png.idat_length, m_png.verify_crc);
+			// two rows each with filter type in front, row before first row is zeros
+			m_rows.assign((row_excl_filt_size + 1) * 2, 0);
+			m_prev = m_rows.data() + row_excl_filt_size + 2;
+
+			if (m_pool && idat_has_flush_point(m_src, m_png)) {
+				m_parallel.emplace(m_idat, *m_pool);
+			}
+			if (m_whole) {
+				m_raw.resize(m_png.raw_size());
+				if ((m_parallel ? m_parallel->read(m_raw) : m_inflater.read_all(m_raw)) != m_raw.size()) {
+					throw std::system_error(make_error_code(PngError::invalid_idat));
+				}
 			}
-			return prev_row[i - 1];
 		}
 
-		row_type prev_row;
-		row_type cur_row;
-		size_t acc_size = 0;
-		const size_t row_excl_filt_size;
-		std::optional<view_type> result;
-		std::istream& m_is;
+		/// @return number of bytes written, less than `out.size()` only when stream is ended
+		size_t inflate(std::span<uint8_t> out) {
+			return m_parallel ? m_parallel->read(out) : m_inflater.read(out);
+		}
+
+		ByteSource& m_src;
 		const Png& m_png;
+		IdatSource m_idat;
+		deflate::Inflater m_inflater;
+		std::optional<deflate::Parallel_inflater> m_parallel;
+		const size_t row_excl_filt_size;
+		const Unfilter unfilter;
+		const convert_fn convert;
+		const luma_fn to_luma;
+		const bool m_whole;
+		ThreadPool* const m_pool;
+		Decode_scratch* const m_scratch;
+		uint32_t m_y = 0;
+		bytes_t m_rows; // double buffered rows of stream mode
+		bytes_t m_raw; // every row of whole mode
+		const uint8_t* m_prev = nullptr;
+		std::vector<pixel_type> m_pixels; // converted row of formats other than 8 bits RGBA
+		std::vector<uint8_t> m_luma;
+		std::vector<bool> m_wanted; // rows to hand out, empty = every row
+		std::vector<bool> m_need; // rows of window that are unfiltered
+		uint8_t* m_win = nullptr; // first row of window with filter type in front
+		uint32_t m_win_begin = 0;
+		uint32_t m_win_end = 0;
 	};
 
 	struct PngFileReader {
-		PngFileReader(const std::string& _path) :path{ _path }, ifs{ _path ,  std::ios::binary }, png{} {};
+		PngFileReader(const std::string& _path) :path{ _path }, png{}, src{ open_source(_path) } {};
+
+		/// read from already opened source e.g. stdin
+		PngFileReader(std::unique_ptr<ByteSource> _src) :path{}, png{}, src{ std::move(_src) } {};
 
 		std::error_code fetch_meta() {
-			if (!ifs.is_open()) {
+			if (!src) {
 				return PngError::fail_open_file;
 			}
-			auto ec = read_meta(ifs, png);
+			auto ec = read_meta(*src, png);
 			if (ec) {
 				return ec;
 			}
-			if (png.ihdr.bitdetph != BitDepth::bit8) {
+			if (num_channel(png.ihdr.color_type) == 0) {
+				return PngError::color_type_not_support;
+			}
+			if (!valid_depth(png.ihdr.color_type, png.ihdr.bitdetph)) {
 				return PngError::bitdepth_not_support;
 			}
-
-			if (png.ihdr.color_type != ColorType::truecolor_a) {
-				return PngError::color_type_not_support;
+			if (png.ihdr.color_type == ColorType::indexed && png.colors.palette_size == 0) {
+				return PngError::invalid_palette;
 			}
 
-			if (png.ihdr.interlace) {
+			if (png.ihdr.interlace > 1) { // only Adam7 is defined
 				return PngError::interlace_not_support;
 			}
+			// buffers are sized from raw size or from pixels of whole image, neither may overflow
+			const size_t h = png.ihdr.height;
+			if (png.row_size() + 1 > SIZE_MAX / h || size_t{ png.ihdr.width } * sizeof(Rgba32) > SIZE_MAX / h) {
+				return PngError::image_too_large;
+			}
 			return {};
 		}
 
-		Row_decoder<Rgba32_view> decoder() {
-			return Row_decoder{ ifs, png };
+		/// image whose raw size is over WHOLE_DECODE_LIMIT is decoded row by row (or by sampled windows)
+		/// @param pool parallel inflate when given
+		/// @param scratch buffers of previous decoder to reuse
+		Row_decoder decoder(ThreadPool* pool = nullptr, Decode_scratch* scratch = nullptr) {
+			const bool whole = png.raw_size() <= WHOLE_DECODE_LIMIT;
+			return Row_decoder{ *src, png, whole, pool, scratch };
 		}
 		
 		const std::string path;
 		Png png;
-		std::ifstream ifs;
+		std::unique_ptr<ByteSource> src;
 
 	};
 }
\ No newline at end of file
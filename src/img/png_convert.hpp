@@ -0,0 +1,255 @@
+#pragma once
+
+#include "luma.hpp"
+#include "pixel.hpp"
+#include <cstdint>
+#include <cstring>
+
+/// https://www.w3.org/TR/png/#6Colour-values
+namespace img::png {
+
+	enum struct BitDepth :uint8_t {
+		bit1 = 1,
+		bit2 = 2,
+		bit4 = 4,
+		bit8 = 8,
+		bit16 = 16,
+	};
+	enum struct ColorType :uint8_t {
+		grayscale = 0,
+		truecolor = 2,
+		indexed = 3,
+		grayscale_a = 4,
+		truecolor_a = 6,
+	};
+
+	int num_channel(ColorType c) {
+		switch (c)
+		{
+		case ColorType::indexed:
+			return 1;
+		case ColorType::grayscale:
+			return 1;
+		case ColorType::grayscale_a:
+			return 2;
+		case ColorType::truecolor:
+			return 3;
+		case ColorType::truecolor_a:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	/// @return true when PNG allows bit depth for color type
+	bool valid_depth(ColorType c, BitDepth d) {
+		switch (c)
+		{
+		case ColorType::grayscale:
+			return d == BitDepth::bit1 || d == BitDepth::bit2 || d == BitDepth::bit4 || d == BitDepth::bit8 || d == BitDepth::bit16;
+		case ColorType::indexed:
+			return d == BitDepth::bit1 || d == BitDepth::bit2 || d == BitDepth::bit4 || d == BitDepth::bit8;
+		case ColorType::truecolor:
+		case ColorType::grayscale_a:
+		case ColorType::truecolor_a:
+			return d == BitDepth::bit8 || d == BitDepth::bit16;
+		default:
+			return false;
+		}
+	}
+
+	/// PLTE and tRNS
+	struct Color_table {
+		/// entries after palette_size are opaque black
+		Rgba32 palette[256];
+		uint8_t palette_luma[256]{}; // luma8() of palette, see update_luma()
+		uint32_t palette_size = 0;
+		/// samples of color that is transparent, grayscale and truecolor only
+		bool has_key = false;
+		uint16_t key[3]{};
+
+		Color_table() {
+			for (auto& c : palette) {
+				c = { 0, 0, 0, 255 };
+			}
+		}
+
+		/// call after palette is changed
+		void update_luma() {
+			for (size_t i = 0; i < 256; ++i) {
+				palette_luma[i] = luma8(palette[i]);
+			}
+		}
+	};
+
+	/// expand one unfiltered row of `width` pixels into 8 bits RGBA, 16 bits samples keep their high byte
+	using convert_fn = void(*)(const uint8_t* row, Rgba32* dst, uint32_t width, const Color_table& colors);
+
+	namespace convert {
+
+		/// `x`th sample of row, samples under 8 bits are packed from most significant bit
+		template<int BD>
+		inline uint32_t sample(const uint8_t* row, size_t x) {
+			if constexpr (BD == 16) {
+				return (uint32_t{ row[2 * x] } << 8) | row[2 * x + 1];
+			}
+			else if constexpr (BD == 8) {
+				return row[x];
+			}
+			else {
+				const size_t bit = x * BD;
+				return (row[bit / 8] >> (8 - BD - bit % 8)) & ((1u << BD) - 1);
+			}
+		}
+
+		/// sample scaled to 8 bits, low depths are replicated e.g. 1 bit become 0 or 255
+		template<int BD>
+		inline uint8_t to8(uint32_t v) {
+			if constexpr (BD == 16) {
+				return static_cast<uint8_t>(v >> 8);
+			}
+			else {
+				return static_cast<uint8_t>(v * (255 / ((1u << BD) - 1)));
+			}
+		}
+
+		/// every color type and depth, branches are resolved at compile time
+		template<ColorType CT, int BD>
+		void row(const uint8_t* src, Rgba32* dst, uint32_t width, const Color_table& colors) {
+			constexpr size_t N = CT == ColorType::grayscale_a ? 2
+				: CT == ColorType::truecolor ? 3
+				: CT == ColorType::truecolor_a ? 4 : 1;
+			for (uint32_t x = 0; x < width; ++x) {
+				const size_t s = x * N;
+				if constexpr (CT == ColorType::indexed) {
+					dst[x] = colors.palette[sample<BD>(src, s)];
+				}
+				else if constexpr (CT == ColorType::grayscale) {
+					const uint32_t v = sample<BD>(src, s);
+					const uint8_t g = to8<BD>(v);
+					dst[x] = { g, g, g, static_cast<uint8_t>(colors.has_key && v == colors.key[0] ? 0 : 255) };
+				}
+				else if constexpr (CT == ColorType::grayscale_a) {
+					const uint8_t g = to8<BD>(sample<BD>(src, s));
+					dst[x] = { g, g, g, to8<BD>(sample<BD>(src, s + 1)) };
+				}
+				else if constexpr (CT == ColorType::truecolor) {
+					const uint32_t r = sample<BD>(src, s);
+					const uint32_t g = sample<BD>(src, s + 1);
+					const uint32_t b = sample<BD>(src, s + 2);
+					const bool key = colors.has_key && r == colors.key[0] && g == colors.key[1] && b == colors.key[2];
+					dst[x] = { to8<BD>(r), to8<BD>(g), to8<BD>(b), static_cast<uint8_t>(key ? 0 : 255) };
+				}
+				else {
+					dst[x] = { to8<BD>(sample<BD>(src, s)), to8<BD>(sample<BD>(src, s + 1)),
+						to8<BD>(sample<BD>(src, s + 2)), to8<BD>(sample<BD>(src, s + 3)) };
+				}
+			}
+		}
+	}
+
+	/// luma8() of one unfiltered row of `width` pixels, alpha is ignored
+	using luma_fn = void(*)(const uint8_t* row, uint8_t* dst, uint32_t width, const Color_table& colors);
+
+	namespace to_luma {
+
+		/// weighted sum of color pixels runs on luma_bytes() SIMD kernel, gray is luma as it is
+		template<ColorType CT, int BD>
+		void row(const uint8_t* src, uint8_t* dst, uint32_t width, const Color_table& colors) {
+			using convert::sample;
+			using convert::to8;
+			constexpr size_t S = BD / 8; // bytes per sample, 16 bits samples use their high byte
+			if constexpr (CT == ColorType::truecolor) {
+				luma_bytes<3 * S, 0, S, 2 * S>(src, width, dst);
+			}
+			else if constexpr (CT == ColorType::truecolor_a) {
+				luma_bytes<4 * S, 0, S, 2 * S>(src, width, dst);
+			}
+			else {
+				constexpr size_t N = CT == ColorType::grayscale_a ? 2 : 1;
+				for (uint32_t x = 0; x < width; ++x) {
+					if constexpr (CT == ColorType::indexed) {
+						dst[x] = colors.palette_luma[sample<BD>(src, x)];
+					}
+					else {
+						dst[x] = to8<BD>(sample<BD>(src, x * N));
+					}
+				}
+			}
+		}
+	}
+
+	/// @return kernel of format, nullptr for 8 bits grayscale that is luma as it is or for invalid format
+	luma_fn select_luma(ColorType c, BitDepth d) {
+		using namespace to_luma;
+		switch (c)
+		{
+		case ColorType::grayscale:
+			switch (d)
+			{
+			case BitDepth::bit1: return row<ColorType::grayscale, 1>;
+			case BitDepth::bit2: return row<ColorType::grayscale, 2>;
+			case BitDepth::bit4: return row<ColorType::grayscale, 4>;
+			case BitDepth::bit16: return row<ColorType::grayscale, 16>;
+			default: return nullptr;
+			}
+		case ColorType::indexed:
+			switch (d)
+			{
+			case BitDepth::bit1: return row<ColorType::indexed, 1>;
+			case BitDepth::bit2: return row<ColorType::indexed, 2>;
+			case BitDepth::bit4: return row<ColorType::indexed, 4>;
+			case BitDepth::bit8: return row<ColorType::indexed, 8>;
+			default: return nullptr;
+			}
+		case ColorType::grayscale_a:
+			return d == BitDepth::bit8 ? row<ColorType::grayscale_a, 8>
+				: d == BitDepth::bit16 ? row<ColorType::grayscale_a, 16> : nullptr;
+		case ColorType::truecolor:
+			return d == BitDepth::bit8 ? row<ColorType::truecolor, 8>
+				: d == BitDepth::bit16 ? row<ColorType::truecolor, 16> : nullptr;
+		case ColorType::truecolor_a:
+			return d == BitDepth::bit8 ? row<ColorType::truecolor_a, 8>
+				: d == BitDepth::bit16 ? row<ColorType::truecolor_a, 16> : nullptr;
+		default:
+			return nullptr;
+		}
+	}
+
+	/// @return kernel of format, nullptr for 8 bits RGBA that is used as is or for invalid format
+	convert_fn select_converter(ColorType c, BitDepth d) {
+		using namespace convert;
+		switch (c)
+		{
+		case ColorType::grayscale:
+			switch (d)
+			{
+			case BitDepth::bit1: return row<ColorType::grayscale, 1>;
+			case BitDepth::bit2: return row<ColorType::grayscale, 2>;
+			case BitDepth::bit4: return row<ColorType::grayscale, 4>;
+			case BitDepth::bit8: return row<ColorType::grayscale, 8>;
+			case BitDepth::bit16: return row<ColorType::grayscale, 16>;
+			default: return nullptr;
+			}
+		case ColorType::indexed:
+			switch (d)
+			{
+			case BitDepth::bit1: return row<ColorType::indexed, 1>;
+			case BitDepth::bit2: return row<ColorType::indexed, 2>;
+			case BitDepth::bit4: return row<ColorType::indexed, 4>;
+			case BitDepth::bit8: return row<ColorType::indexed, 8>;
+			default: return nullptr;
+			}
+		case ColorType::grayscale_a:
+			return d == BitDepth::bit8 ? row<ColorType::grayscale_a, 8>
+				: d == BitDepth::bit16 ? row<ColorType::grayscale_a, 16> : nullptr;
+		case ColorType::truecolor:
+			return d == BitDepth::bit8 ? row<ColorType::truecolor, 8>
+				: d == BitDepth::bit16 ? row<ColorType::truecolor, 16> : nullptr;
+		case ColorType::truecolor_a:
+			return d == BitDepth::bit16 ? row<ColorType::truecolor_a, 16> : nullptr;
+		default:
+			return nullptr;
+		}
+	}
+}
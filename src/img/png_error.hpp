@@ -15,7 +15,10 @@ namespace img::png
         idat_not_found,
         invalid_idat,
         fail_open_file,
-        deflate_decompress_fail
+        deflate_decompress_fail,
+        invalid_palette,
+        crc_mismatch,
+        image_too_large
     };
 
     struct PngCategory : std::error_category
@@ -48,6 +51,12 @@ namespace img::png
                 return "can't open file";
             case PngError::deflate_decompress_fail:
                 return "deflate decompress fail";
+            case PngError::invalid_palette:
+                return "no valid PLTE or tRNS";
+            case PngError::crc_mismatch:
+                return "chunk CRC mismatch";
+            case PngError::image_too_large:
+                return "image too large";
             default:
                 return "unknown error";
             }
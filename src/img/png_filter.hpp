@@ -0,0 +1,300 @@
+#pragma once
+
+#include "cpu.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+/// https://www.w3.org/TR/png/#9Filters
+/// SSE2 kernels follow libpng's contrib intel/filter_sse2_intrinsics.c
+namespace img::png {
+
+	enum struct FilterType :uint8_t {
+		None = 0,
+		Sub ,
+		Up ,
+		Average ,
+		Paeth,
+	};
+
+	int paeth(int a, int b, int c) {
+		int p = a + b - c;
+		int pa = std::abs(p - a);
+		int pb = std::abs(p - b);
+		int pc = std::abs(p - c);
+
+		if (pa <= pb && pa <= pc) {
+			return a;
+		}
+		if (pb <= pc) {
+			return b;
+		}
+		return c;
+	}
+
+	/// reconstruct filtered `row` of `size` bytes in place, `prev` is previous reconstructed row
+	/// (zeros for first row) and `bpp` is bytes per complete pixel
+	using unfilter_fn = void(*)(uint8_t* row, const uint8_t* prev, size_t size, size_t bpp);
+
+	namespace filter {
+
+		// `a` is byte of previous pixel, `b` is same byte of previous row
+		// and `c` is previous pixel of previous row
+
+		void sub(uint8_t* row, const uint8_t*, size_t size, size_t bpp) {
+			for (size_t i = bpp; i < size; i++) {
+				row[i] += row[i - bpp];
+			}
+		}
+
+		void up(uint8_t* row, const uint8_t* prev, size_t size, size_t) {
+			for (size_t i = 0; i < size; i++) {
+				row[i] += prev[i];
+			}
+		}
+
+		void avg(uint8_t* row, const uint8_t* prev, size_t size, size_t bpp) {
+			for (size_t i = 0; i < bpp && i < size; i++) {
+				row[i] += prev[i] / 2;
+			}
+			for (size_t i = bpp; i < size; i++) {
+				row[i] += (row[i - bpp] + prev[i]) / 2;
+			}
+		}
+
+		void paeth(uint8_t* row, const uint8_t* prev, size_t size, size_t bpp) {
+			for (size_t i = 0; i < bpp && i < size; i++) {
+				row[i] += prev[i];
+			}
+			for (size_t i = bpp; i < size; i++) {
+				row[i] += png::paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			}
+		}
+
+#if defined(IMG_X86)
+		IMG_TARGET("sse2") inline __m128i load4(const void* p) {
+			int32_t v;
+			std::memcpy(&v, p, 4);
+			return _mm_cvtsi32_si128(v);
+		}
+
+		IMG_TARGET("sse2") inline void store4(void* p, __m128i v) {
+			int32_t t = _mm_cvtsi128_si32(v);
+			std::memcpy(p, &t, 4);
+		}
+
+		IMG_TARGET("sse2") inline __m128i load3(const void* p) {
+			int32_t v = 0;
+			std::memcpy(&v, p, 3);
+			return _mm_cvtsi32_si128(v);
+		}
+
+		IMG_TARGET("sse2") inline void store3(void* p, __m128i v) {
+			int32_t t = _mm_cvtsi128_si32(v);
+			std::memcpy(p, &t, 3);
+		}
+
+		IMG_TARGET("sse2") void up_sse2(uint8_t* row, const uint8_t* prev, size_t size, size_t bpp) {
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_add_epi8(x, b));
+			}
+			up(row + i, prev + i, size - i, bpp);
+		}
+
+		IMG_TARGET("avx2") void up_avx2(uint8_t* row, const uint8_t* prev, size_t size, size_t bpp) {
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+				__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prev + i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(row + i), _mm256_add_epi8(x, b));
+			}
+			up_sse2(row + i, prev + i, size - i, bpp);
+		}
+
+		/// prefix sum of 4 pixels in one register then add last pixel of previous step
+		IMG_TARGET("sse2") void sub4_sse2(uint8_t* row, const uint8_t*, size_t size, size_t) {
+			__m128i carry = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= size; i += 16) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+				x = _mm_add_epi8(x, carry);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), x);
+				carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+			}
+			for (; i < size; i += 4) {
+				__m128i x = _mm_add_epi8(load4(row + i), carry);
+				store4(row + i, x);
+				carry = x;
+			}
+		}
+
+		/// same as sub4_sse2 but 4 pixels are 12 bytes of 16 bytes load
+		IMG_TARGET("sse2") void sub3_sse2(uint8_t* row, const uint8_t*, size_t size, size_t) {
+			const __m128i mask3 = _mm_cvtsi32_si128(0x00ff'ffff);
+			__m128i carry = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= size; i += 12) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+				x = _mm_add_epi8(x, carry);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(row + i), x);
+				store4(row + i + 8, _mm_srli_si128(x, 8));
+				carry = _mm_and_si128(_mm_srli_si128(x, 9), mask3);
+				carry = _mm_or_si128(carry, _mm_slli_si128(carry, 3));
+				carry = _mm_or_si128(carry, _mm_slli_si128(carry, 6));
+			}
+			for (; i + 4 <= size; i += 3) {
+				carry = _mm_add_epi8(load4(row + i), carry);
+				store3(row + i, carry);
+			}
+			if (i < size) {
+				store3(row + i, _mm_add_epi8(load3(row + i), carry));
+			}
+		}
+
+		/// truncating average from rounding one of _mm_avg_epu8
+		IMG_TARGET("sse2") inline __m128i avg_floor(__m128i a, __m128i b) {
+			__m128i avg = _mm_avg_epu8(a, b);
+			return _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+		}
+
+		IMG_TARGET("sse2") void avg4_sse2(uint8_t* row, const uint8_t* prev, size_t size, size_t) {
+			__m128i d = _mm_setzero_si128();
+			for (size_t i = 0; i < size; i += 4) {
+				__m128i b = load4(prev + i);
+				d = _mm_add_epi8(load4(row + i), avg_floor(d, b));
+				store4(row + i, d);
+			}
+		}
+
+		IMG_TARGET("sse2") void avg3_sse2(uint8_t* row, const uint8_t* prev, size_t size, size_t) {
+			__m128i d = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 4 <= size; i += 3) {
+				__m128i b = load4(prev + i);
+				d = _mm_add_epi8(load4(row + i), avg_floor(d, b));
+				store3(row + i, d);
+			}
+			if (i < size) {
+				__m128i b = load3(prev + i);
+				d = _mm_add_epi8(load3(row + i), avg_floor(d, b));
+				store3(row + i, d);
+			}
+		}
+
+		IMG_TARGET("sse2") inline __m128i if_then_else(__m128i c, __m128i t, __m128i e) {
+			return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+		}
+
+		IMG_TARGET("sse2") inline __m128i abs_i16(__m128i x) {
+			__m128i neg = _mm_cmplt_epi16(x, _mm_setzero_si128());
+			x = _mm_xor_si128(x, neg);
+			return _mm_add_epi16(x, _mm_srli_epi16(neg, 15));
+		}
+
+		/// one pixel of 16 bits lanes, `a` `b` `c` and `d` are kept unpacked
+		IMG_TARGET("sse2") inline __m128i paeth_step(__m128i a, __m128i b, __m128i c, __m128i d) {
+			__m128i pa = _mm_sub_epi16(b, c); // p - a
+			__m128i pb = _mm_sub_epi16(a, c); // p - b
+			__m128i pc = _mm_add_epi16(pa, pb); // p - c
+			pa = abs_i16(pa);
+			pb = abs_i16(pb);
+			pc = abs_i16(pc);
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i nearest = if_then_else(_mm_cmpeq_epi16(smallest, pa), a,
+				if_then_else(_mm_cmpeq_epi16(smallest, pb), b, c));
+			return _mm_add_epi8(d, nearest); // wrap every lane at 8 bits
+		}
+
+		IMG_TARGET("sse2") void paeth4_sse2(uint8_t* row, const uint8_t* prev, size_t size, size_t) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i b = zero, d = zero;
+			for (size_t i = 0; i < size; i += 4) {
+				__m128i c = b;
+				b = _mm_unpacklo_epi8(load4(prev + i), zero);
+				__m128i a = d;
+				d = paeth_step(a, b, c, _mm_unpacklo_epi8(load4(row + i), zero));
+				store4(row + i, _mm_packus_epi16(d, d));
+			}
+		}
+
+		IMG_TARGET("sse2") void paeth3_sse2(uint8_t* row, const uint8_t* prev, size_t size, size_t) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i b = zero, d = zero;
+			size_t i = 0;
+			for (; i + 4 <= size; i += 3) {
+				__m128i c = b;
+				b = _mm_unpacklo_epi8(load4(prev + i), zero);
+				__m128i a = d;
+				d = paeth_step(a, b, c, _mm_unpacklo_epi8(load4(row + i), zero));
+				store3(row + i, _mm_packus_epi16(d, d));
+			}
+			if (i < size) {
+				__m128i c = b;
+				b = _mm_unpacklo_epi8(load3(prev + i), zero);
+				__m128i a = d;
+				d = paeth_step(a, b, c, _mm_unpacklo_epi8(load3(row + i), zero));
+				store3(row + i, _mm_packus_epi16(d, d));
+			}
+		}
+#endif
+	}
+
+	/// unfilter kernels picked once for pixel size and running cpu
+	struct Unfilter {
+		explicit Unfilter(size_t _bpp) :bpp{ _bpp } {
+#if defined(IMG_X86)
+			const auto& f = cpu::features();
+			if (f.sse2) {
+				up = f.avx2 ? filter::up_avx2 : filter::up_sse2;
+				if (bpp == 3) {
+					sub = filter::sub3_sse2;
+					avg = filter::avg3_sse2;
+					paeth = filter::paeth3_sse2;
+				}
+				else if (bpp == 4) {
+					sub = filter::sub4_sse2;
+					avg = filter::avg4_sse2;
+					paeth = filter::paeth4_sse2;
+				}
+			}
+#endif
+		}
+
+		/// @return false when filter type is unknown
+		bool operator()(FilterType type, uint8_t* row, const uint8_t* prev, size_t size) const {
+			switch (type)
+			{
+			case FilterType::None:
+				return true;
+			case FilterType::Sub:
+				sub(row, prev, size, bpp);
+				return true;
+			case FilterType::Up:
+				up(row, prev, size, bpp);
+				return true;
+			case FilterType::Average:
+				avg(row, prev, size, bpp);
+				return true;
+			case FilterType::Paeth:
+				paeth(row, prev, size, bpp);
+				return true;
+			default:
+				return false;
+			}
+		}
+
+	private:
+		size_t bpp;
+		unfilter_fn sub = filter::sub;
+		unfilter_fn up = filter::up;
+		unfilter_fn avg = filter::avg;
+		unfilter_fn paeth = filter::paeth;
+	};
+}
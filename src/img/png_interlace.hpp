@@ -0,0 +1,197 @@
+#pragma once
+
+#include "png.hpp"
+
+/// https://www.w3.org/TR/png/#8Interlace
+namespace img::png {
+
+	struct Adam7_pass {
+		uint32_t x0, y0, dx, dy;
+	};
+
+	constexpr Adam7_pass ADAM7[7] = {
+		{ 0, 0, 8, 8 },
+		{ 4, 0, 8, 8 },
+		{ 0, 4, 4, 8 },
+		{ 2, 0, 4, 4 },
+		{ 0, 2, 2, 4 },
+		{ 1, 0, 2, 2 },
+		{ 0, 1, 1, 2 },
+	};
+
+	/// spacing of pixels that are known after first `passes` passes, they form regular lattice
+	constexpr uint32_t ADAM7_STEP_X[7] = { 8, 4, 4, 2, 2, 1, 1 };
+	constexpr uint32_t ADAM7_STEP_Y[7] = { 8, 8, 4, 4, 2, 2, 1 };
+
+	/// size of reduced image of pass `p` (0 based), pass is empty when either side is 0
+	inline uint32_t pass_width(const Png& png, int p) {
+		return png.ihdr.width > ADAM7[p].x0 ? (png.ihdr.width - ADAM7[p].x0 + ADAM7[p].dx - 1) / ADAM7[p].dx : 0;
+	}
+
+	inline uint32_t pass_height(const Png& png, int p) {
+		return png.ihdr.height > ADAM7[p].y0 ? (png.ihdr.height - ADAM7[p].y0 + ADAM7[p].dy - 1) / ADAM7[p].dy : 0;
+	}
+
+	/// size of image that first `passes` passes make, every pixel of it is known
+	inline uint32_t lattice_width(const Png& png, int passes) {
+		return (png.ihdr.width + ADAM7_STEP_X[passes - 1] - 1) / ADAM7_STEP_X[passes - 1];
+	}
+
+	inline uint32_t lattice_height(const Png& png, int passes) {
+		return (png.ihdr.height + ADAM7_STEP_Y[passes - 1] - 1) / ADAM7_STEP_Y[passes - 1];
+	}
+
+	/// fewest passes whose lattice is at least `width` x `height`
+	inline int passes_for(const Png& png, uint32_t width, uint32_t height) {
+		int passes = 1;
+		while (passes < 7 && (lattice_width(png, passes) < width || lattice_height(png, passes) < height)) {
+			++passes;
+		}
+		return passes;
+	}
+
+	/// decode Adam7 image from first `passes` passes, data of later passes isn't even inflated.
+	/// with fewer than 7 passes the image is reduced to lattice of known pixels, see lattice_width().
+	/// every pass is unfiltered on its own then scattered into image that decoder keeps whole
+	struct Interlaced_decoder {
+		using pixel_type = Rgba32;
+		using row_type = std::span<const pixel_type>;
+
+		using iterator = Row_iterator<Interlaced_decoder>;
+
+		/// @param passes 1 to 7
+		Interlaced_decoder(ByteSource& src, const Png& png, int passes = 7) :
+			m_png{ png },
+			m_idat{ src },
+			m_inflater{ m_idat },
+			m_passes{ std::clamp(passes, 1, 7) },
+			unfilter{ png.bpp() },
+			convert{ select_converter(png.ihdr.color_type, png.ihdr.bitdetph) },
+			to_luma{ select_luma(png.ihdr.color_type, png.ihdr.bitdetph) }
+		{
+		}
+
+		/// hand out only `rows` of lattice (ascending) instead of every row, lattice is
+		/// still decoded whole since every pass cover whole image
+		void sample(std::span<const uint32_t> rows) {
+			m_rows = rows;
+		}
+
+		/// @return next row of lattice, empty when every row is handed out
+		row_type next() {
+			if (m_image.empty()) {
+				decode(m_image);
+			}
+			return lattice_row(m_image);
+		}
+
+		/// next row of lattice as luma8() of its pixels, passes are turned into luma right
+		/// from unfiltered bytes so lattice of pixels is never built
+		/// @return empty when every row is handed out
+		std::span<const uint8_t> next_luma() {
+			if (m_luma.empty()) {
+				decode(m_luma);
+			}
+			return lattice_row(m_luma);
+		}
+
+		iterator begin() { return iterator{ this, next() }; }
+		iterator end() { return iterator{ this, {} }; }
+
+	private:
+		template<typename PX>
+		std::span<const PX> lattice_row(const std::vector<PX>& image) {
+			const uint32_t w = lattice_width(m_png, m_passes);
+			if (m_y == (m_rows.empty() ? lattice_height(m_png, m_passes) : m_rows.size())) {
+				return {};
+			}
+			const uint32_t y = m_rows.empty() ? m_y : m_rows[m_y];
+			++m_y;
+			return { image.data() + size_t{ w } * y, w };
+		}
+
+		/// unfiltered row of pass as pixels, 8 bits RGBA is used as is
+		const pixel_type* expand(const uint8_t* row, std::vector<pixel_type>& buf, uint32_t width) const {
+			if (!convert) {
+				return reinterpret_cast<const pixel_type*>(row);
+			}
+			convert(row, buf.data(), width, m_png.colors);
+			return buf.data();
+		}
+
+		/// unfiltered row of pass as luma, 8 bits grayscale is used as is
+		const uint8_t* expand(const uint8_t* row, std::vector<uint8_t>& buf, uint32_t width) const {
+			if (!to_luma) {
+				return row;
+			}
+			to_luma(row, buf.data(), width, m_png.colors);
+			return buf.data();
+		}
+
+		/// @param image lattice of pixels or of luma
+		template<typename PX>
+		void decode(std::vector<PX>& image) {
+			const uint32_t sx = ADAM7_STEP_X[m_passes - 1];
+			const uint32_t sy = ADAM7_STEP_Y[m_passes - 1];
+			const uint32_t w = lattice_width(m_png, m_passes);
+			image.resize(size_t{ w } * lattice_height(m_png, m_passes));
+			m_idat.open(m_png.idat_length, m_png.verify_crc);
+
+			bytes_t rows;
+			std::vector<PX> pixels;
+			for (int p = 0; p < m_passes; ++p) {
+				const uint32_t pw = pass_width(m_png, p);
+				const uint32_t ph = pass_height(m_png, p);
+				if (pw == 0 || ph == 0) {
+					continue; // empty pass has no data, not even filter type
+				}
+				const size_t row_size = m_png.row_size(pw);
+				// row before first row of pass is zeros
+				rows.assign((row_size + 1) * 2, 0);
+				uint8_t* prev = rows.data() + row_size + 2;
+				pixels.resize(pw);
+				for (uint32_t py = 0; py < ph; ++py) {
+					uint8_t* line = prev == rows.data() + 1 ? rows.data() + row_size + 1 : rows.data();
+					if (m_inflater.read({ line, row_size + 1 }) != row_size + 1) {
+						throw std::system_error(make_error_code(PngError::invalid_idat));
+					}
+					uint8_t* cur = line + 1;
+					if (!unfilter(static_cast<FilterType>(line[0]), cur, prev, row_size)) {
+						throw std::system_error(make_error_code(PngError::invalid_idat));
+					}
+					prev = cur;
+
+					const PX* src = expand(cur, pixels, pw);
+					// pass pixels fall on lattice since its step divides offset and spacing of every earlier pass
+					const Adam7_pass& pass = ADAM7[p];
+					PX* dst = image.data() + size_t{ w } * ((pass.y0 + py * pass.dy) / sy) + pass.x0 / sx;
+					const uint32_t step = pass.dx / sx;
+					for (uint32_t px = 0; px < pw; ++px) {
+						dst[px * step] = src[px];
+					}
+				}
+			}
+			// data of passes that aren't decoded is read only for CRC of its chunks
+			if (m_png.verify_crc) {
+				m_idat.drain();
+			}
+		}
+
+		const Png& m_png;
+		IdatSource m_idat;
+		deflate::Inflater m_inflater;
+		const int m_passes;
+		const Unfilter unfilter;
+		const convert_fn convert;
+		const luma_fn to_luma;
+		std::vector<pixel_type> m_image; // lattice of every decoded pass
+		std::vector<uint8_t> m_luma; // lattice as luma, when rows are taken by next_luma()
+		std::span<const uint32_t> m_rows; // sampled rows, empty = every row
+		uint32_t m_y = 0;
+	};
+
+	/// @param passes 1 to 7, fewer passes give reduced image
+	inline Interlaced_decoder interlaced_decoder(PngFileReader& reader, int passes = 7) {
+		return Interlaced_decoder{ *reader.src, reader.png, passes };
+	}
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "png.hpp"
+#include "thread_pool.hpp"
+#include <exception>
+#include <thread>
+
+namespace img::png {
+
+	/// rows of one step of pipeline, every row has filter type in front
+	struct Row_batch {
+		bytes_t data;
+		uint32_t rows = 0;
+	};
+
+	/// decode rows on three stages: inflate and unfilter each run on own thread while
+	/// caller of next() render rows. batches of rows go through bounded queues and
+	/// are recycled once caller moves past them, so memory doesn't grow with image size
+	struct Pipelined_decoder {
+		using pixel_type = Rgba32;
+		using row_type = std::span<const pixel_type>;
+		using iterator = Row_iterator<Pipelined_decoder>;
+
+		/// rows of batch are about this size
+		static constexpr size_t BATCH_BYTES = 1 << 18;
+		/// batches in flight
+		static constexpr size_t BATCHES = 4;
+
+		/// @param pool inflate segments between full flush points in parallel, inflate is
+		/// serial on its own thread otherwise
+		Pipelined_decoder(ByteSource& src, const Png& png, ThreadPool* pool = nullptr) :
+			m_src{ src },
+			m_png{ png },
+			m_pool{ pool },
+			row_excl_filt_size{ png.row_size() },
+			rows_per_batch{ static_cast<uint32_t>(std::clamp<size_t>(BATCH_BYTES / (png.row_size() + 1), 1, std::max(png.ihdr.height, 1u))) },
+			unfilter{ png.bpp() },
+			convert{ select_converter(png.ihdr.color_type, png.ihdr.bitdetph) },
+			to_luma{ select_luma(png.ihdr.color_type, png.ihdr.bitdetph) }
+		{
+		}
+
+		Pipelined_decoder(const Pipelined_decoder&) = delete;
+		Pipelined_decoder& operator=(const Pipelined_decoder&) = delete;
+
+		~Pipelined_decoder() {
+			abort();
+			for (auto& t : m_threads) {
+				if (t.joinable()) {
+					t.join();
+				}
+			}
+		}
+
+		/// @return next row, empty when every row is decoded
+		row_type next() {
+			const uint8_t* row = next_unfiltered();
+			if (!row) {
+				return {};
+			}
+			if (!convert) {
+				return { reinterpret_cast<const pixel_type*>(row), m_png.ihdr.width };
+			}
+			m_pixels.resize(m_png.ihdr.width);
+			convert(row, m_pixels.data(), m_png.ihdr.width, m_png.colors);
+			return m_pixels;
+		}
+
+		/// next row as luma8() of its pixels, computed right from unfiltered bytes.
+		/// 8 bits grayscale is handed out as is
+		/// @return empty when every row is decoded
+		std::span<const uint8_t> next_luma() {
+			const uint8_t* row = next_unfiltered();
+			if (!row) {
+				return {};
+			}
+			if (!to_luma) {
+				return { row, m_png.ihdr.width };
+			}
+			m_luma.resize(m_png.ihdr.width);
+			to_luma(row, m_luma.data(), m_png.ihdr.width, m_png.colors);
+			return m_luma;
+		}
+
+		iterator begin() { return iterator{ this, next() }; }
+		iterator end() { return iterator{ this, {} }; }
+
+	private:
+		/// @return next unfiltered row of batch that caller is reading, nullptr when every row is decoded
+		const uint8_t* next_unfiltered() {
+			if (!m_started) {
+				start();
+			}
+			if (m_cur && m_row == m_cur->rows) {
+				m_free.push(std::move(*m_cur));
+				m_cur.reset();
+			}
+			if (!m_cur) {
+				m_cur = m_ready.pop();
+				m_row = 0;
+				if (!m_cur) {
+					rethrow();
+					return nullptr;
+				}
+			}
+			const uint8_t* line = m_cur->data.data() + m_row * (row_excl_filt_size + 1) + 1;
+			++m_row;
+			return line;
+		}
+
+		void start() {
+			m_started = true;
+			for (size_t i = 0; i < BATCHES; ++i) {
+				Row_batch batch;
+				batch.data.reserve(rows_per_batch * (row_excl_filt_size + 1));
+				m_free.push(std::move(batch));
+			}
+			m_threads[0] = std::thread{ [this] { run(&Pipelined_decoder::inflate_stage, m_filtered); } };
+			m_threads[1] = std::thread{ [this] { run(&Pipelined_decoder::unfilter_stage, m_ready); } };
+		}
+
+		/// run stage then close its output queue, stop every stage on error
+		void run(void (Pipelined_decoder::* stage)(), BoundedQueue<Row_batch>& out) {
+			try {
+				(this->*stage)();
+				out.close();
+			}
+			catch (...) {
+				{
+					std::lock_guard lock{ m_error_mutex };
+					if (!m_error) {
+						m_error = std::current_exception();
+					}
+				}
+				abort();
+			}
+		}
+
+		void abort() {
+			m_free.close();
+			m_filtered.close();
+			m_ready.close();
+		}
+
+		void rethrow() {
+			std::lock_guard lock{ m_error_mutex };
+			if (m_error) {
+				std::rethrow_exception(m_error);
+			}
+		}
+
+		void inflate_stage() {
+			IdatSource idat{ m_src };
+			idat.open(m_png.idat_length, m_png.verify_crc);
+
+			// with pool, segments between full flush points are inflated in parallel as stream is read
+			std::optional<deflate::Parallel_inflater> parallel;
+			if (m_pool && idat_has_flush_point(m_src, m_png)) {
+				parallel.emplace(idat, *m_pool);
+			}
+			deflate::Inflater inflater{ idat };
+
+			for (uint32_t y = 0; y < m_png.ihdr.height; ) {
+				auto batch = m_free.pop();
+				if (!batch) {
+					return;
+				}
+				batch->rows = std::min(rows_per_batch, m_png.ihdr.height - y);
+				batch->data.resize(batch->rows * (row_excl_filt_size + 1));
+				if ((parallel ? parallel->read(batch->data) : inflater.read(batch->data)) != batch->data.size()) {
+					throw std::system_error(make_error_code(PngError::invalid_idat));
+				}
+				y += batch->rows;
+				if (!m_filtered.push(std::move(*batch))) {
+					return;
+				}
+			}
+			if (m_png.verify_crc) {
+				idat.drain();
+			}
+		}
+
+		void unfilter_stage() {
+			bytes_t prev(row_excl_filt_size, 0); // last row of previous batch
+			while (auto batch = m_filtered.pop()) {
+				const uint8_t* prev_row = prev.data();
+				uint8_t* line = batch->data.data();
+				for (uint32_t r = 0; r < batch->rows; ++r, line += row_excl_filt_size + 1) {
+					if (!unfilter(static_cast<FilterType>(line[0]), line + 1, prev_row, row_excl_filt_size)) {
+						throw std::system_error(make_error_code(PngError::invalid_idat));
+					}
+					prev_row = line + 1;
+				}
+				std::memcpy(prev.data(), prev_row, row_excl_filt_size);
+				if (!m_ready.push(std::move(*batch))) {
+					return;
+				}
+			}
+		}
+
+		ByteSource& m_src;
+		const Png& m_png;
+		ThreadPool* const m_pool;
+		const size_t row_excl_filt_size;
+		const uint32_t rows_per_batch;
+		const Unfilter unfilter;
+		const convert_fn convert;
+		const luma_fn to_luma;
+		BoundedQueue<Row_batch> m_free{ BATCHES };
+		BoundedQueue<Row_batch> m_filtered{ BATCHES };
+		BoundedQueue<Row_batch> m_ready{ BATCHES };
+		std::thread m_threads[2];
+		std::exception_ptr m_error;
+		std::mutex m_error_mutex;
+		std::optional<Row_batch> m_cur; // batch that caller is reading
+		uint32_t m_row = 0;
+		std::vector<pixel_type> m_pixels; // converted row of formats other than 8 bits RGBA
+		std::vector<uint8_t> m_luma;
+		bool m_started = false;
+	};
+
+	/// pipelined decoder of file, three threads are used
+	inline Pipelined_decoder pipelined_decoder(PngFileReader& reader, ThreadPool* pool = nullptr) {
+		return Pipelined_decoder{ *reader.src, reader.png, pool };
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+namespace img
+{
+	/// input iterator of decoder that hand out rows by next(), empty row is end
+	template<typename VIEW>
+	struct Row_iterator
+	{
+		using view_type = VIEW;
+		using row_type = typename VIEW::row_type;
+		using iterator_category = std::input_iterator_tag;
+		using value_type = row_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const row_type*;
+		using reference = const row_type&;
+		using self_type = Row_iterator;
+
+		Row_iterator(view_type* _view, row_type _row) :view{ _view }, row{ _row } {}
+
+		self_type& operator++()
+		{
+			row = view->next();
+			return *this;
+		}
+		void operator++(int)
+		{
+			++(*this);
+		}
+		bool operator==(const self_type& other) const { return row.data() == other.row.data(); }
+		bool operator!=(const self_type& other) const { return !(*this == other); }
+		reference operator*() const { return row; }
+
+	private:
+		view_type* view;
+		row_type row;
+	};
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "pixel.hpp"
+#include <algorithm>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace img
+{
+	struct Size {
+		uint32_t width;
+		uint32_t height;
+	};
+
+	/// output size for wanted width and/or height (0 = not given), never bigger than source.
+	/// when only one side is given the other keep aspect ratio with half height
+	/// because character is about twice as tall as wide
+	inline Size fit_size(Size src, Size want) {
+		if (src.width == 0 || src.height == 0 || (want.width == 0 && want.height == 0)) {
+			return src;
+		}
+		Size ret;
+		if (want.width && want.height) {
+			ret = want;
+		}
+		else if (want.width) {
+			ret.width = want.width;
+			ret.height = static_cast<uint32_t>((uint64_t{ src.height } * want.width + src.width) / (2ull * src.width));
+		}
+		else {
+			ret.height = want.height;
+			ret.width = static_cast<uint32_t>((uint64_t{ src.width } * want.height * 2 + src.height / 2) / src.height);
+		}
+		ret.width = std::clamp(ret.width, 1u, src.width);
+		ret.height = std::clamp(ret.height, 1u, src.height);
+		return ret;
+	}
+
+	/// area average (box filter) of source into smaller image, source rows are pushed one by
+	/// one and only one row of sums is kept. source pixel `x` belongs to output column
+	/// `x * dst_w / src_w`, same for rows.
+	/// with `taps`, each cell average only `taps` x `taps` pixels spread evenly over it so
+	/// decoder can skip every other row, see rows().
+	/// `OUT` is Rgb24 to average color or uint8_t to average luma plane.
+	/// `bottom_up` source pushes its rows from last one up and get output rows from last one up
+	template<typename OUT = Rgb24>
+	struct BoxScaler {
+		/// channels of output pixel
+		static constexpr size_t N = std::is_same_v<OUT, uint8_t> ? 1 : 3;
+
+		/// @param taps pixels per cell side to sample, 0 = every pixel
+		BoxScaler(Size src, Size dst, uint32_t taps = 0, bool bottom_up = false) :
+			m_src{ src },
+			m_dst{ dst },
+			m_col_end(dst.width),
+			m_sums(dst.width * N),
+			m_out(dst.width)
+		{
+			m_row_end.reserve(dst.height);
+			for (uint32_t o = 0; o < dst.height; ++o) {
+				if (taps) {
+					sample(first_of(o, dst.height, src.height), first_of(o + 1, dst.height, src.height), taps, m_rows);
+				}
+				m_row_end.push_back(taps ? static_cast<uint32_t>(m_rows.size()) : first_of(o + 1, dst.height, src.height));
+			}
+			if (bottom_up) { // same bands, counted from last one
+				const uint32_t total = m_row_end.empty() ? 0 : m_row_end.back();
+				std::reverse(m_row_end.begin(), m_row_end.end());
+				for (uint32_t o = 0; o + 1 < dst.height; ++o) {
+					m_row_end[o] = total - m_row_end[o + 1];
+				}
+				if (!m_row_end.empty()) {
+					m_row_end.back() = total;
+				}
+			}
+			for (uint32_t o = 0; o < dst.width; ++o) {
+				if (taps) {
+					sample(first_of(o, dst.width, src.width), first_of(o + 1, dst.width, src.width), taps, m_cols);
+				}
+				m_col_end[o] = taps ? static_cast<uint32_t>(m_cols.size()) : first_of(o + 1, dst.width, src.width);
+			}
+		}
+
+		/// @param row next source row, or next row of rows() when sampled (in reverse when bottom up).
+		/// rows beyond are ignored
+		/// @return output row when `row` is last one of its band, else empty. it is valid until next push
+		template<typename PX>
+		std::span<const OUT> push(std::span<const PX> row) {
+			if (m_oy >= m_dst.height) {
+				return {};
+			}
+			if (m_cols.empty()) {
+				accumulate(row, [](uint32_t x) { return x; });
+			}
+			else {
+				accumulate(row, [cols = m_cols.data()](uint32_t i) { return cols[i]; });
+			}
+			++m_y;
+			++m_band_rows;
+			if (m_y != m_row_end[m_oy]) {
+				return {};
+			}
+			emit();
+			return m_out;
+		}
+
+		/// @return true when only rows() are pushed
+		bool sampled() const {
+			return !m_rows.empty();
+		}
+
+		/// source rows that are sampled in ascending order, empty when every row is used
+		std::span<const uint32_t> rows() const {
+			return m_rows;
+		}
+
+		Size size() const {
+			return m_dst;
+		}
+
+	private:
+		/// first source index of output index `o`
+		static uint32_t first_of(uint32_t o, uint32_t dst, uint32_t src) {
+			return static_cast<uint32_t>((uint64_t{ o } * src + dst - 1) / dst);
+		}
+
+		/// append `taps` indexes at centers of equal parts of [begin, end), or all of them when fewer
+		static void sample(uint32_t begin, uint32_t end, uint32_t taps, std::vector<uint32_t>& out) {
+			const uint32_t n = end - begin;
+			if (n <= taps) {
+				for (uint32_t i = begin; i < end; ++i) {
+					out.push_back(i);
+				}
+				return;
+			}
+			for (uint32_t k = 0; k < taps; ++k) {
+				out.push_back(begin + static_cast<uint32_t>((uint64_t{ 2 * k + 1 } * n) / (2ull * taps)));
+			}
+		}
+
+		/// @param at source column of `i`th tap
+		template<typename PX, typename AT>
+		void accumulate(std::span<const PX> row, AT at) {
+			uint64_t* sum = m_sums.data();
+			uint32_t i = 0;
+			for (uint32_t ox = 0; ox < m_dst.width; ++ox, sum += N) {
+				if constexpr (N == 1) {
+					uint64_t y = 0;
+					for (const uint32_t end = m_col_end[ox]; i < end; ++i) {
+						y += row[at(i)];
+					}
+					sum[0] += y;
+				}
+				else {
+					uint64_t r = 0, g = 0, b = 0;
+					for (const uint32_t end = m_col_end[ox]; i < end; ++i) {
+						const PX& px = row[at(i)];
+						r += px.r;
+						g += px.g;
+						b += px.b;
+					}
+					sum[0] += r;
+					sum[1] += g;
+					sum[2] += b;
+				}
+			}
+		}
+
+		void emit() {
+			uint32_t i = 0;
+			for (uint32_t ox = 0; ox < m_dst.width; ++ox) {
+				const uint64_t n = uint64_t{ m_col_end[ox] - i } * m_band_rows;
+				const uint64_t* sum = &m_sums[ox * N];
+				if constexpr (N == 1) {
+					m_out[ox] = static_cast<uint8_t>((sum[0] + n / 2) / n);
+				}
+				else {
+					m_out[ox].r = static_cast<uint8_t>((sum[0] + n / 2) / n);
+					m_out[ox].g = static_cast<uint8_t>((sum[1] + n / 2) / n);
+					m_out[ox].b = static_cast<uint8_t>((sum[2] + n / 2) / n);
+				}
+				i = m_col_end[ox];
+			}
+			std::fill(m_sums.begin(), m_sums.end(), 0);
+			m_band_rows = 0;
+			++m_oy;
+		}
+
+		const Size m_src;
+		const Size m_dst;
+		std::vector<uint32_t> m_rows; // sampled source rows, empty = every row
+		std::vector<uint32_t> m_cols; // sampled source columns, empty = every column
+		std::vector<uint32_t> m_row_end; // number of pushed rows at end of each band
+		std::vector<uint32_t> m_col_end; // one past last source column (or tap) of each output column
+		std::vector<uint64_t> m_sums; // channels of each output column
+		std::vector<OUT> m_out;
+		uint32_t m_y = 0; // rows pushed
+		uint32_t m_oy = 0;
+		uint32_t m_band_rows = 0;
+	};
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <concepts>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace img
+{
+	using bytes_view = std::span<const uint8_t>;
+
+	/// where decoders read bytes from, bytes are handed out as view into source's
+	/// own memory so mapped file is parsed without copy
+	struct ByteSource {
+		virtual ~ByteSource() = default;
+
+		/// consume up to `n` bytes, view is valid until next call of any member
+		/// @return empty only at end of source
+		virtual bytes_view take(size_t n) = 0;
+
+		/// @return false when `pos` can't be reached
+		virtual bool seek(uint64_t pos) = 0;
+
+		virtual uint64_t tell() const = 0;
+
+		/// @return false when source can only go forward e.g. pipe, seek() to later
+		/// position still works by reading through
+		virtual bool seekable() const {
+			return true;
+		}
+
+		bool skip(uint64_t n) {
+			return seek(tell() + n);
+		}
+
+		/// consume `n` bytes as one view, `scratch` hold them only when source
+		/// can't hand out them contiguously
+		/// @return shorter than `n` only at end of source
+		bytes_view take_exact(size_t n, std::vector<uint8_t>& scratch) {
+			bytes_view v = take(n);
+			if (v.size() == n || v.empty()) {
+				return v;
+			}
+			scratch.resize(n);
+			size_t done = 0;
+			do {
+				std::memcpy(scratch.data() + done, v.data(), v.size());
+				done += v.size();
+			} while (done < n && !(v = take(n - done)).empty());
+			return { scratch.data(), done };
+		}
+
+		/// copy next `n` bytes into `dst`
+		/// @return number of bytes copied, less than `n` only at end of source
+		size_t read(void* dst, size_t n) {
+			size_t done = 0;
+			while (done < n) {
+				bytes_view v = take(n - done);
+				if (v.empty()) {
+					break;
+				}
+				std::memcpy(static_cast<uint8_t*>(dst) + done, v.data(), v.size());
+				done += v.size();
+			}
+			return done;
+		}
+	};
+
+	template<typename T>
+	concept int_like = std::integral<T> || std::is_enum_v<T>;
+
+	/// @return false at end of source
+	template<int_like T>
+	bool read_le(ByteSource& src, T& v) {
+		uint8_t b[sizeof(T)];
+		if (src.read(b, sizeof(T)) != sizeof(T)) {
+			return false;
+		}
+		uint64_t r = 0;
+		for (size_t i = 0; i < sizeof(T); ++i) {
+			r |= static_cast<uint64_t>(b[i]) << (8 * i);
+		}
+		v = static_cast<T>(r);
+		return true;
+	}
+
+	/// @return false at end of source
+	template<int_like T>
+	bool read_be(ByteSource& src, T& v) {
+		uint8_t b[sizeof(T)];
+		if (src.read(b, sizeof(T)) != sizeof(T)) {
+			return false;
+		}
+		uint64_t r = 0;
+		for (size_t i = 0; i < sizeof(T); ++i) {
+			r = (r << 8) | b[i];
+		}
+		v = static_cast<T>(r);
+		return true;
+	}
+
+	/// buffered std::istream, for anything that can't be mapped e.g. pipe
+	struct StreamSource : ByteSource {
+		static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+		explicit StreamSource(std::istream& is) :m_is{ &is }, m_buf(BUFFER_SIZE), m_seekable{ probe(is) } {}
+
+		explicit StreamSource(std::unique_ptr<std::istream> is) :
+			m_owned{ std::move(is) }, m_is{ m_owned.get() }, m_buf(BUFFER_SIZE), m_seekable{ probe(*m_is) } {}
+
+		/// view is contiguous up to buffer size
+		bytes_view take(size_t n) override {
+			if (m_end - m_next < n && (m_next == m_end || n <= m_buf.size())) {
+				fill();
+			}
+			n = std::min(n, m_end - m_next);
+			bytes_view v{ m_buf.data() + m_next, n };
+			m_next += n;
+			return v;
+		}
+
+		bool seek(uint64_t pos) override {
+			if (pos >= m_base && pos <= m_base + m_end) {
+				m_next = pos - m_base;
+				return true;
+			}
+			if (!m_seekable) { // read through to later position
+				if (pos < tell()) {
+					return false;
+				}
+				while (tell() < pos) {
+					if (take(std::min<uint64_t>(pos - tell(), m_buf.size())).empty()) {
+						return false;
+					}
+				}
+				return true;
+			}
+			m_is->clear();
+			if (!m_is->seekg(pos, std::ios::beg)) {
+				return false;
+			}
+			m_base = pos;
+			m_next = m_end = 0;
+			return true;
+		}
+
+		uint64_t tell() const override {
+			return m_base + m_next;
+		}
+
+		bool seekable() const override {
+			return m_seekable;
+		}
+
+	private:
+		static bool probe(std::istream& is) {
+			const bool ret = is.tellg() != std::streampos(-1);
+			is.clear();
+			return ret;
+		}
+
+		/// move unread bytes to front then read until buffer is full
+		void fill() {
+			size_t keep = m_end - m_next;
+			std::memmove(m_buf.data(), m_buf.data() + m_next, keep);
+			m_base += m_next;
+			m_next = 0;
+			m_is->read(reinterpret_cast<char*>(m_buf.data()) + keep, m_buf.size() - keep);
+			m_end = keep + m_is->gcount();
+		}
+
+		std::unique_ptr<std::istream> m_owned;
+		std::istream* m_is;
+		std::vector<uint8_t> m_buf;
+		uint64_t m_base = 0; // stream position of `m_buf[0]`
+		size_t m_next = 0;
+		size_t m_end = 0;
+		const bool m_seekable;
+	};
+
+	/// bytes that already in memory, views point into them
+	struct MemorySource : ByteSource {
+		explicit MemorySource(bytes_view data) :m_data{ data.data() }, m_size{ data.size() } {}
+
+		bytes_view take(size_t n) override {
+			n = std::min(n, m_size - m_pos);
+			bytes_view v{ m_data + m_pos, n };
+			m_pos += n;
+			return v;
+		}
+
+		bool seek(uint64_t pos) override {
+			if (pos > m_size) {
+				return false;
+			}
+			m_pos = static_cast<size_t>(pos);
+			return true;
+		}
+
+		uint64_t tell() const override {
+			return m_pos;
+		}
+
+		/// every byte of source
+		bytes_view data() const {
+			return { m_data, m_size };
+		}
+
+	protected:
+		const uint8_t* m_data;
+		size_t m_size;
+		size_t m_pos = 0;
+	};
+
+	/// read only mapping of whole file, every view points into page cache
+	struct MappedSource : MemorySource {
+		MappedSource(const MappedSource&) = delete;
+		MappedSource& operator=(const MappedSource&) = delete;
+
+		~MappedSource() override {
+#if defined(_WIN32)
+			UnmapViewOfFile(m_data);
+#else
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		}
+
+		/// @return nullptr when file can't be mapped e.g. not regular file or empty
+		static std::unique_ptr<MappedSource> open(const std::string& path) {
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				return nullptr;
+			}
+			LARGE_INTEGER size{};
+			if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+				CloseHandle(file);
+				return nullptr;
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping) {
+				return nullptr;
+			}
+			// view stays valid after its handles are closed
+			void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (!data) {
+				return nullptr;
+			}
+			return std::unique_ptr<MappedSource>(new MappedSource(static_cast<const uint8_t*>(data), static_cast<size_t>(size.QuadPart)));
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return nullptr;
+			}
+			struct stat st {};
+			if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+				close(fd);
+				return nullptr;
+			}
+			void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) {
+				return nullptr;
+			}
+			madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+			return std::unique_ptr<MappedSource>(new MappedSource(static_cast<const uint8_t*>(data), static_cast<size_t>(st.st_size)));
+#endif
+		}
+
+	private:
+		MappedSource(const uint8_t* data, size_t size) :MemorySource{ { data, size } } {}
+	};
+
+	/// map file when possible else fall back to stream
+	/// @return nullptr when file can't be opened
+	inline std::unique_ptr<ByteSource> open_source(const std::string& path) {
+		if (auto mapped = MappedSource::open(path)) {
+			return mapped;
+		}
+		auto ifs = std::make_unique<std::ifstream>(path, std::ios::binary);
+		if (!ifs->is_open()) {
+			return nullptr;
+		}
+		return std::make_unique<StreamSource>(std::move(ifs));
+	}
+
+	/// standard input, it may be pipe that can only be read forward
+	inline std::unique_ptr<ByteSource> open_stdin() {
+#if defined(_WIN32)
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		return std::make_unique<StreamSource>(std::cin);
+	}
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace img
+{
+	/// fixed number of threads that run submitted tasks in order of submission
+	struct ThreadPool {
+		/// @param n number of threads, 0 mean number of hardware threads
+		explicit ThreadPool(size_t n = 0) {
+			if (n == 0) {
+				n = std::max(1u, std::thread::hardware_concurrency());
+			}
+			m_threads.reserve(n);
+			for (size_t i = 0; i < n; ++i) {
+				m_threads.emplace_back([this] { run(); });
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		/// wait for every submitted task
+		~ThreadPool() {
+			{
+				std::lock_guard lock{ m_mutex };
+				m_stop = true;
+			}
+			m_cv.notify_all();
+			for (auto& t : m_threads) {
+				t.join();
+			}
+		}
+
+		/// exception of task is rethrown by get() of returned future
+		template<typename F>
+		auto submit(F&& f) -> std::future<std::invoke_result_t<F>> {
+			using result_type = std::invoke_result_t<F>;
+			auto task = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(f));
+			auto ret = task->get_future();
+			{
+				std::lock_guard lock{ m_mutex };
+				m_tasks.emplace([task] { (*task)(); });
+			}
+			m_cv.notify_one();
+			return ret;
+		}
+
+		size_t size() const {
+			return m_threads.size();
+		}
+
+	private:
+		void run() {
+			for (;;) {
+				std::function<void()> task;
+				{
+					std::unique_lock lock{ m_mutex };
+					m_cv.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+					if (m_tasks.empty()) {
+						return;
+					}
+					task = std::move(m_tasks.front());
+					m_tasks.pop();
+				}
+				task();
+			}
+		}
+
+		std::vector<std::thread> m_threads;
+		std::queue<std::function<void()>> m_tasks;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_stop = false;
+	};
+
+	/// threads that each has own task deque, idle thread steal oldest task of others.
+	/// task get index of worker that run it, for state that is kept per worker
+	struct WorkStealingPool {
+		using task_type = std::function<void(size_t)>;
+
+		/// @param n number of threads, 0 mean number of hardware threads
+		explicit WorkStealingPool(size_t n = 0) {
+			if (n == 0) {
+				n = std::max(1u, std::thread::hardware_concurrency());
+			}
+			for (size_t i = 0; i < n; ++i) {
+				m_workers.push_back(std::make_unique<Worker>());
+			}
+			m_threads.reserve(n);
+			for (size_t i = 0; i < n; ++i) {
+				m_threads.emplace_back([this, i] { run(i); });
+			}
+		}
+
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		/// wait for every submitted task
+		~WorkStealingPool() {
+			wait();
+			{
+				std::lock_guard lock{ m_mutex };
+				m_stop = true;
+			}
+			m_cv.notify_all();
+			for (auto& t : m_threads) {
+				t.join();
+			}
+		}
+
+		/// tasks are spread over workers round robin, task must not throw
+		void submit(task_type task) {
+			Worker& w = *m_workers[m_next++ % m_workers.size()];
+			{
+				std::lock_guard lock{ w.mutex };
+				w.tasks.push_back(std::move(task));
+			}
+			{
+				std::lock_guard lock{ m_mutex };
+				++m_queued;
+				++m_unfinished;
+			}
+			m_cv.notify_one();
+		}
+
+		/// wait until every submitted task is done
+		void wait() {
+			std::unique_lock lock{ m_mutex };
+			m_done_cv.wait(lock, [this] { return m_unfinished == 0; });
+		}
+
+		size_t size() const {
+			return m_threads.size();
+		}
+
+	private:
+		struct Worker {
+			std::deque<task_type> tasks;
+			std::mutex mutex;
+		};
+
+		/// newest task of own deque first then oldest task of others
+		bool take(size_t self, task_type& task) {
+			for (size_t k = 0; k < m_workers.size(); ++k) {
+				Worker& w = *m_workers[(self + k) % m_workers.size()];
+				std::lock_guard lock{ w.mutex };
+				if (w.tasks.empty()) {
+					continue;
+				}
+				if (k == 0) {
+					task = std::move(w.tasks.back());
+					w.tasks.pop_back();
+				}
+				else {
+					task = std::move(w.tasks.front());
+					w.tasks.pop_front();
+				}
+				return true;
+			}
+			return false;
+		}
+
+		void run(size_t self) {
+			for (;;) {
+				{
+					std::unique_lock lock{ m_mutex };
+					m_cv.wait(lock, [this] { return m_stop || m_queued > 0; });
+					if (m_queued == 0) {
+						return;
+					}
+					--m_queued;
+				}
+				// a task is reserved by m_queued so one of deques hold it
+				task_type task;
+				while (!take(self, task)) {
+					std::this_thread::yield();
+				}
+				task(self);
+				{
+					std::lock_guard lock{ m_mutex };
+					if (--m_unfinished == 0) {
+						m_done_cv.notify_all();
+					}
+				}
+			}
+		}
+
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::vector<std::thread> m_threads;
+		std::atomic<size_t> m_next = 0;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::condition_variable m_done_cv;
+		size_t m_queued = 0; // tasks in deques that no worker reserved yet
+		size_t m_unfinished = 0;
+		bool m_stop = false;
+	};
+
+	/// blocking queue of fixed capacity that hand items from one thread to another
+	template<typename T>
+	struct BoundedQueue {
+		explicit BoundedQueue(size_t capacity) :m_capacity{ capacity } {}
+
+		/// wait for room
+		/// @return false when queue is closed, item is dropped then
+		bool push(T item) {
+			std::unique_lock lock{ m_mutex };
+			m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+			if (m_closed) {
+				return false;
+			}
+			m_items.push_back(std::move(item));
+			m_not_empty.notify_one();
+			return true;
+		}
+
+		/// wait for item
+		/// @return empty when queue is closed and every item is taken
+		std::optional<T> pop() {
+			std::unique_lock lock{ m_mutex };
+			m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+			if (m_items.empty()) {
+				return std::nullopt;
+			}
+			T item = std::move(m_items.front());
+			m_items.pop_front();
+			m_not_full.notify_one();
+			return item;
+		}
+
+		/// no more push, every waiter is woken
+		void close() {
+			{
+				std::lock_guard lock{ m_mutex };
+				m_closed = true;
+			}
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+		}
+
+	private:
+		const size_t m_capacity;
+		std::deque<T> m_items;
+		std::mutex m_mutex;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+		bool m_closed = false;
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace img
+{
+	/// collect output in one big buffer and hand it to OS (or stream) in one write
+	struct BufferedWriter {
+		static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+		/// write straight to file descriptor e.g. 1 for stdout, descriptor isn't closed
+		explicit BufferedWriter(int fd) :m_fd{ fd }, m_buf(BUFFER_SIZE) {}
+
+		explicit BufferedWriter(std::ostream& os) :m_os{ &os }, m_buf(BUFFER_SIZE) {}
+
+		BufferedWriter(const BufferedWriter&) = delete;
+		BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+		~BufferedWriter() {
+			flush();
+		}
+
+		/// room for `n` bytes, must be followed by commit()
+		char* reserve(size_t n) {
+			if (m_buf.size() - m_len < n) {
+				flush();
+				if (m_buf.size() < n) {
+					m_buf.resize(n);
+				}
+			}
+			return m_buf.data() + m_len;
+		}
+
+		/// @param n bytes that filled after reserve()
+		void commit(size_t n) {
+			m_len += n;
+		}
+
+		void write(const char* p, size_t n) {
+			std::memcpy(reserve(n), p, n);
+			commit(n);
+		}
+
+		void put(char c) {
+			*reserve(1) = c;
+			commit(1);
+		}
+
+		void flush() {
+			if (m_len == 0) {
+				return;
+			}
+			if (m_os) {
+				m_os->write(m_buf.data(), m_len);
+				m_os->flush();
+				m_failed |= !m_os->good();
+			}
+			else if (!m_failed) {
+				m_failed = !write_fd(m_buf.data(), m_len);
+			}
+			m_len = 0;
+		}
+
+		/// flush then write to `os` from now, buffer is kept for reuse
+		void redirect(std::ostream& os) {
+			flush();
+			m_os = &os;
+			m_fd = -1;
+			m_failed = false;
+		}
+
+		/// flush then write to file descriptor from now
+		void redirect(int fd) {
+			flush();
+			m_os = nullptr;
+			m_fd = fd;
+			m_failed = false;
+		}
+
+		/// false after any write is failed e.g. closed pipe, output after that is dropped
+		bool good() const {
+			return !m_failed;
+		}
+
+	private:
+		bool write_fd(const char* p, size_t n) {
+			while (n > 0) {
+#if defined(_WIN32)
+				int w = _write(m_fd, p, static_cast<unsigned>(std::min<size_t>(n, 1u << 30)));
+				if (w < 0) {
+					return false;
+				}
+#else
+				ssize_t w = ::write(m_fd, p, n);
+				if (w < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+#endif
+				p += w;
+				n -= static_cast<size_t>(w);
+			}
+			return true;
+		}
+
+		int m_fd = -1;
+		std::ostream* m_os = nullptr;
+		std::vector<char> m_buf;
+		size_t m_len = 0;
+		bool m_failed = false;
+	};
+}
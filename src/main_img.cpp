@@ -1,90 +1,466 @@
 ﻿#include "img/bmp.hpp"
+#include "img/format.hpp"
 #include "img/png.hpp"
+#include "img/png_pipeline.hpp"
+#include "img/png_interlace.hpp"
+#include "img/ascii.hpp"
+#include "img/writer.hpp"
+#include "img/thread_pool.hpp"
+#include "img/scale.hpp"
+#include <filesystem>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
 
-/// @param table higher luminance first
-/// @param len length for table;
-template<typename T>
-char to_char(T c, const std::string& table) {
-	return table[static_cast<size_t>(img::luminance(c) * table.length()) % table.length()];
+/// map row of pixels straight into output buffer as one line of characters
+template<typename PX>
+void write_row(img::BufferedWriter& out, std::span<const PX> row, const img::ascii::CharMap& map) {
+	char* line = out.reserve(row.size() + 1);
+	map.map_row(row, line);
+	line[row.size()] = '\n';
+	out.commit(row.size() + 1);
 }
 
 void stream_error(std::ostream& err, const std::error_code& ec) {
 	err << '[' << ec.category().name() << ':' << ec.value() << ']' << ' ' << ec.message() << '\n';
 }
 
-int cmd_convert_png(const std::string& in, std::ostream& os, std::ostream& err, const std::string& table) {
+/// what every conversion share
+struct Convert_context {
+	const img::ascii::CharMap& map;
+	img::Size size{}; // wanted output size, 0 = not given
+	uint32_t taps = 0; // pixels per cell side that are sampled when scaled down, 0 = every pixel
+	int passes = 7; // Adam7 passes that are decoded, fewer give reduced preview
+	bool verify_crc = false; // check CRC of PNG chunks
+	img::ThreadPool* pool = nullptr; // PNG pipeline and parallel inflate
+	img::png::Decode_scratch* scratch = nullptr; // buffers that kept between images, only for serial decode
+};
+
+/// lines of output in order, or from last one up that are kept until every line is mapped
+struct Line_sink {
+	Line_sink(img::BufferedWriter& out, const img::ascii::CharMap& map, img::Size size, bool bottom_up) :
+		m_out{ out }, m_map{ map }, m_width{ size.width }, m_left{ size.height }
+	{
+		if (bottom_up) {
+			m_lines.resize(size_t{ size.width + 1 } * size.height);
+		}
+	}
+
+	template<typename PX>
+	void put(std::span<const PX> row) {
+		if (m_lines.empty()) {
+			write_row(m_out, row, m_map);
+			return;
+		}
+		char* line = m_lines.data() + size_t{ m_width + 1 } * --m_left;
+		m_map.map_row(row, line);
+		line[m_width] = '\n';
+	}
+
+	void finish() {
+		if (!m_lines.empty()) {
+			m_out.write(m_lines.data(), m_lines.size());
+		}
+	}
+
+private:
+	img::BufferedWriter& m_out;
+	const img::ascii::CharMap& m_map;
+	const uint32_t m_width;
+	uint32_t m_left;
+	std::vector<char> m_lines;
+};
+
+/// write every row of decoder as luma plane, area averaged down when wanted size is smaller than image
+/// @param full size that output keeps aspect ratio of when decoder hand out reduced image
+/// @param bottom_up decoder hand out rows from last one up
+template<typename DECODER>
+void render(DECODER& decoder, img::Size image, img::BufferedWriter& out, const Convert_context& ctx, img::Size full = {}, bool bottom_up = false) {
+	img::Luma_rows rows{ decoder };
+	img::Size size = img::fit_size(full.width ? full : image, ctx.size);
+	size = { std::min(size.width, image.width), std::min(size.height, image.height) };
+	Line_sink sink{ out, ctx.map, size, bottom_up };
+	if (size.width == image.width && size.height == image.height) {
+		for (auto row : rows) {
+			sink.put(row);
+		}
+		sink.finish();
+		return;
+	}
+	// scaler that samples expects only its rows, decoder that can't skip rows get every pixel averaged
+	constexpr bool can_sample = requires { rows.sample(std::span<const uint32_t>{}); };
+	img::BoxScaler<uint8_t> scaler{ image, size, can_sample ? ctx.taps : 0, bottom_up };
+	if constexpr (can_sample) {
+		if (scaler.sampled()) {
+			rows.sample(scaler.rows());
+		}
+	}
+	for (auto row : rows) {
+		if (auto scaled = scaler.push(row); !scaled.empty()) {
+			sink.put(scaled);
+		}
+	}
+	sink.finish();
+}
+
+int cmd_convert_png(std::unique_ptr<img::ByteSource> src, img::BufferedWriter& out, std::ostream& err, const Convert_context& ctx) {
 	using namespace img::png;
 
-	PngFileReader re{in};
+	PngFileReader re{ std::move(src) };
+	re.png.verify_crc = ctx.verify_crc;
 	if (auto ec = re.fetch_meta()) {
 		stream_error(err, ec);
 		return 1;
 	}
-	auto decoder = re.decoder();
-	auto row_gen = decoder();
-
-	while (row_gen) {
-		//auto row_view = row_gen();
-		for (auto p : *row_gen()){
-			os << to_char(p, table);
+	const img::Size image{ re.png.ihdr.width, re.png.ihdr.height };
+	if (re.png.ihdr.interlace) {
+		int passes = ctx.passes;
+		if (ctx.taps) {
+			// sampling is approximate anyway, passes whose lattice already cover output are enough
+			const img::Size size = img::fit_size(image, ctx.size);
+			passes = std::min(passes, passes_for(re.png, size.width, size.height));
 		}
-		os << "\n";
+		auto decoder = interlaced_decoder(re, passes);
+		render(decoder, { lattice_width(re.png, passes), lattice_height(re.png, passes) }, out, ctx, image);
+	}
+	else if (ctx.pool && !ctx.taps) {
+		auto decoder = pipelined_decoder(re, ctx.pool);
+		render(decoder, image, out, ctx);
+	}
+	else {
+		auto decoder = re.decoder(ctx.pool, ctx.scratch);
+		render(decoder, image, out, ctx);
 	}
 	return 0;
 }
 
+/// bytes of output that bottom up BMP may keep in memory to read its rows forward
+constexpr uint64_t REVERSE_OUTPUT_LIMIT = 64ull << 20;
+
 /// @return error code
-int cmd_convert_bmp(const std::string& in, std::ostream& os, std::ostream& err, const std::string& table) {
+int cmd_convert_bmp(std::unique_ptr<img::ByteSource> src, img::BufferedWriter& out, std::ostream& err, const Convert_context& ctx) {
 	using namespace img::bmp;
-	BmpFileReader freader{in};
+	BmpFileReader freader{ std::move(src) };
 	if (auto ec = freader.fetch_meta()) {
 		stream_error(err, ec);
 		return 1;
 	}
 	
-	for (auto& row : freader.view()) {
-		for (auto p : row) {
-			os << to_char(p, table);
-		}
-		os << '\n';
+	const img::Size image{ freader.bmp.width(), freader.bmp.height() };
+	auto view = freader.view();
+	// bottom up rows are read forward and output is kept until its first line arrive,
+	// unless output is too big to keep and source can go back for each row
+	const img::Size size = img::fit_size(image, ctx.size);
+	bool bottom_up = false;
+	if (!freader.src->seekable() || uint64_t{ size.width + 1 } * size.height <= REVERSE_OUTPUT_LIMIT) {
+		bottom_up = view.file_order();
 	}
+	render(view, image, out, ctx, {}, bottom_up);
 	return 0;
 }
 
-int cmd_convert(const std::string& in, std::ostream& os, std::ostream& err, const std::string& table) {
-	int ec = cmd_convert_bmp(in, os, err, table);
-	if (ec == 0) {
-		return 0;
+using convert_fn = int(*)(std::unique_ptr<img::ByteSource> src, img::BufferedWriter& out, std::ostream& err, const Convert_context& ctx);
+
+/// decoder of each format, it get source that is opened once and positioned at start of file
+constexpr struct {
+	img::Format format;
+	convert_fn convert;
+} converters[] = {
+	{ img::Format::bmp, cmd_convert_bmp },
+	{ img::Format::png, cmd_convert_png },
+};
+
+int cmd_convert(const std::string& in, img::BufferedWriter& out, std::ostream& err, const Convert_context& ctx) {
+	auto src = in == "-" ? img::open_stdin() : img::open_source(in);
+	if (!src) {
+		stream_error(err, img::FormatError::fail_open_file);
+		return 1;
 	}
+	const img::Format format = img::sniff(*src);
+	for (const auto& c : converters) {
+		if (c.format == format) {
+			return c.convert(std::move(src), out, err, ctx);
+		}
+	}
+	stream_error(err, img::FormatError::unknown_format);
+	return 1;
+}
 
-	return cmd_convert_png(in, os, err, table);
+struct Job {
+	std::filesystem::path in;
+	std::filesystem::path out;
+};
+
+bool is_image_file(const std::filesystem::path& p) {
+	std::string ext = p.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return ext == ".bmp" || ext == ".png";
+}
+
+/// expand directories (recursively, only .bmp and .png) and list files into jobs,
+/// output of file under directory keep its relative path under `out_dir`.
+/// same file given more than once is converted once
+/// @return false when any input can't be read or two inputs would write same output
+bool collect_jobs(const std::vector<std::string>& inputs, const std::vector<std::string>& lists,
+	const std::filesystem::path& out_dir, std::vector<Job>& jobs, std::ostream& err) {
+	namespace fs = std::filesystem;
+	std::vector<std::string> paths = inputs;
+	for (const auto& list : lists) {
+		std::ifstream ifs{ list };
+		if (!ifs) {
+			err << "[batch] can't read list " << list << '\n';
+			return false;
+		}
+		for (std::string line; std::getline(ifs, line); ) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (!line.empty()) {
+				paths.push_back(line);
+			}
+		}
+	}
+	for (const auto& path : paths) {
+		std::error_code ec;
+		if (fs::is_directory(path)) { // missing file is reported by its own job
+			for (fs::recursive_directory_iterator it{ path, ec }, end; !ec && it != end; it.increment(ec)) {
+				if (it->is_regular_file(ec) && is_image_file(it->path())) {
+					fs::path rel = fs::relative(it->path(), path, ec);
+					jobs.push_back({ it->path(), out_dir / rel.concat(".txt") });
+				}
+			}
+		}
+		else {
+			jobs.push_back({ path, out_dir / fs::path{ path }.filename().concat(".txt") });
+		}
+		if (ec) {
+			err << "[batch] " << path << ": " << ec.message() << '\n';
+			return false;
+		}
+	}
+
+	// workers must not share output, failed job would remove output of other one
+	std::unordered_map<std::string, size_t> owner; // output path to its job
+	std::vector<Job> unique;
+	unique.reserve(jobs.size());
+	for (auto& job : jobs) {
+		auto [it, added] = owner.try_emplace(job.out.lexically_normal().string(), unique.size());
+		if (added) {
+			unique.push_back(std::move(job));
+			continue;
+		}
+		const Job& first = unique[it->second];
+		std::error_code ec;
+		if (!fs::equivalent(first.in, job.in, ec)) {
+			err << "[batch] " << first.in.string() << " and " << job.in.string()
+				<< " both output to " << job.out.string() << '\n';
+			return false;
+		}
+	}
+	jobs = std::move(unique);
+	return true;
+}
+
+/// state that each worker reuse from file to file
+struct Worker_state {
+	img::BufferedWriter out{ -1 };
+	img::png::Decode_scratch scratch;
+};
+
+/// convert every job on work stealing pool, each result to own file
+/// @return number of failed jobs
+size_t cmd_batch(const std::vector<Job>& jobs, std::ostream& err, const Convert_context& ctx, size_t threads) {
+	namespace fs = std::filesystem;
+	for (const auto& job : jobs) {
+		std::error_code ec;
+		fs::create_directories(job.out.parent_path(), ec);
+	}
+
+	std::mutex err_mutex;
+	std::atomic<size_t> failed = 0;
+	std::vector<Worker_state> states(threads);
+	{
+		img::WorkStealingPool pool{ threads };
+		for (const auto& job : jobs) {
+			pool.submit([&](size_t worker) {
+				Worker_state& state = states[worker];
+				std::ostringstream msg;
+				int ec = 1;
+				std::ofstream ofs{ job.out, std::ios::binary };
+				if (!ofs) {
+					msg << "can't write " << job.out.string() << '\n';
+				}
+				else {
+					state.out.redirect(ofs);
+					try {
+						Convert_context job_ctx = ctx;
+						job_ctx.scratch = &state.scratch;
+						ec = cmd_convert(job.in.string(), state.out, msg, job_ctx);
+					}
+					catch (std::exception& e) {
+						msg << "[error] " << e.what() << '\n';
+					}
+					state.out.flush();
+					if (!state.out.good()) {
+						ec = 1;
+						msg << "can't write " << job.out.string() << '\n';
+					}
+				}
+				if (ec) {
+					if (ofs.is_open()) {
+						ofs.close();
+						std::error_code rm_ec;
+						fs::remove(job.out, rm_ec);
+					}
+					++failed;
+					std::lock_guard lock{ err_mutex };
+					err << job.in.string() << ":\n" << msg.str();
+				}
+			});
+		}
+	}
+	err << "[batch] " << jobs.size() - failed << " converted, " << failed << " failed\n";
+	return failed;
 }
 
 constexpr auto help_text =
 "usage:\n"
-" funny_img <image path> [char table (default=ABCDEFG)]\n"
-"  - accept only some bmp and some png format\n"
+" funny_img [options] <image path or - for stdin> [char table (default=ABCDEFG)]\n"
+" funny_img [options] -o <output dir> [-l <list file>]... [image path or dir]...\n"
+"  - accept bmp (except 2 bits and OS/2 header) and png\n"
 "  - output will send to stdout (redirect by POSIX 1>)\n"
-"  - error/info will send to stderr (redirect by POSIX 2>)\n";
+"  - error/info will send to stderr (redirect by POSIX 2>)\n"
+"  - with -o, every image is converted to <output dir>/<name>.txt concurrently,\n"
+"    directories are searched recursively for .bmp and .png\n"
+"options:\n"
+"  -t <table>    char table\n"
+"  -w <columns>  output width, image is area averaged down to it\n"
+"  -h <rows>     output height, when only one of -w and -h is given the other keep\n"
+"                aspect ratio of image with half rows as character is tall\n"
+"  -s <n>        when scaled down, average only n x n pixels spread over each\n"
+"                character so rows between them are skipped (0 = every pixel).\n"
+"                interlaced PNG decode only Adam7 passes that are enough for output\n"
+"  -p <passes>   interlaced PNG, decode only first 1 to 7 Adam7 passes for quick\n"
+"                low resolution preview (default=7)\n"
+"  -c            check CRC of PNG chunks (IHDR, PLTE, tRNS and IDAT)\n"
+"  -o <dir>      batch mode, output directory\n"
+"  -l <file>     batch mode, file that list one image path per line\n"
+"  -j <threads>  decode PNG on threads, inflate, unfilter and output overlap and\n"
+"                inflate itself is parallel where encoder made full flush points.\n"
+"                in batch mode, number of files that converted at once\n"
+"                (0 = every hardware thread, default=1 or every thread for batch)\n";
+
+struct Options {
+	std::vector<std::string> inputs;
+	std::vector<std::string> lists;
+	std::string out_dir;
+	std::string table = "ABCDEFG";
+	long threads = -1; // not given
+	long width = 0;
+	long height = 0;
+	long taps = 0;
+	long passes = 7;
+	bool verify_crc = false;
+};
+
+/// @return false when arguments are invalid
+bool parse_args(int argc, const char** argv, Options& opt) {
+	std::vector<std::string> positional;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view arg = argv[i];
+		if (arg == "-c") {
+			opt.verify_crc = true;
+		}
+		else if (arg == "-j" || arg == "-t" || arg == "-o" || arg == "-l" || arg == "-w" || arg == "-h" || arg == "-s" || arg == "-p") {
+			if (++i == argc) {
+				return false;
+			}
+			const char* value = argv[i];
+			if (arg == "-j" || arg == "-w" || arg == "-h" || arg == "-s" || arg == "-p") {
+				char* end = nullptr;
+				long n = std::strtol(value, &end, 10);
+				if (*end != '\0' || end == value || n < 0 || n > INT32_MAX) {
+					return false;
+				}
+				(arg == "-j" ? opt.threads : arg == "-w" ? opt.width : arg == "-h" ? opt.height : arg == "-s" ? opt.taps : opt.passes) = n;
+			}
+			else if (arg == "-t") {
+				opt.table = value;
+			}
+			else if (arg == "-o") {
+				opt.out_dir = value;
+			}
+			else {
+				opt.lists.emplace_back(value);
+			}
+		}
+		else {
+			positional.emplace_back(arg);
+		}
+	}
+	if (opt.table.empty() || opt.passes < 1 || opt.passes > 7) {
+		return false;
+	}
+	if (!opt.out_dir.empty()) {
+		opt.inputs = std::move(positional);
+		return !opt.inputs.empty() || !opt.lists.empty();
+	}
+	if (!opt.lists.empty() || positional.empty() || positional.size() > 2) {
+		return false;
+	}
+	opt.inputs.push_back(positional[0]);
+	if (positional.size() == 2) {
+		if (positional[1].empty()) {
+			return false;
+		}
+		opt.table = positional[1];
+	}
+	return true;
+}
 
 int main(int argc, const char** argv)
 {
-	if (argc != 2 && argc != 3)
+	Options opt;
+	if (!parse_args(argc, argv, opt))
 	{
 		std::cerr << "invalid arguments\n"
 			<< help_text;
 		return 1;
 	}
-	try {
-		if (argc == 2) {
-			return cmd_convert(argv[1], std::cout, std::cerr, std::string{ "ABCDEFG" });
+	const img::ascii::CharMap map{ opt.table };
+	Convert_context ctx{ map, { static_cast<uint32_t>(opt.width), static_cast<uint32_t>(opt.height) }, static_cast<uint32_t>(opt.taps), static_cast<int>(opt.passes), opt.verify_crc };
+	const bool batch = !opt.out_dir.empty();
+	size_t threads = opt.threads < 0 ? (batch ? 0 : 1) : static_cast<size_t>(opt.threads);
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	if (batch) {
+		std::vector<Job> jobs;
+		if (!collect_jobs(opt.inputs, opt.lists, opt.out_dir, jobs, std::cerr)) {
+			return 1;
 		}
-		if (argc == 3) {
-			return cmd_convert(argv[1], std::cout, std::cerr, argv[2]);
+		return cmd_batch(jobs, std::cerr, ctx, threads) ? 1 : 0;
+	}
+
+	std::optional<img::ThreadPool> pool;
+	if (threads > 1) {
+		pool.emplace(threads);
+	}
+	img::BufferedWriter out{ 1 }; // stdout, bypass std::cout
+	try {
+		ctx.pool = pool ? &*pool : nullptr;
+		const int ec = cmd_convert(opt.inputs[0], out, std::cerr, ctx);
+		out.flush();
+		if (!out.good()) { // e.g. disk full, output is incomplete
+			std::cerr << "[error] can't write output\n";
+			return 1;
 		}
+		return ec;
 	}
 	catch (std::exception& e) {
+		out.flush();
 		std::cerr << "[error] " << e.what() << '\n';
 	}
-	return 0;
+	return 1; // decode error, same as error that is found before decoding
 }
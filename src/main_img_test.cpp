@@ -16,12 +16,8 @@ int main() {
 		return 1;
 	}
 
-	auto decoder = re.decoder();
-	auto row_gen = decoder();
-
-	while (row_gen) {
-		auto row_view_ptr = row_gen();
-		for (auto pixel: *row_view_ptr) {
+	for (auto row : re.decoder()) {
+		for (auto pixel: row) {
 			info(pixel);
 		}
 		std::cout << "\n";